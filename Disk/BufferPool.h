@@ -5,75 +5,210 @@
 #include "macros.h"
 #include "PageGuard.h"
 #include "Page.h"
-
+#include "Replacer.h"
+#include "PageTable.h"
+#include "ThreadPool.h"
+#include "IOBackend.h"
+#include "HybridLatch.h"
+#include "Stats.h"
+
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
 #include <cstddef>
+#include <cstring>
 #include <filesystem>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <shared_mutex>
 #include <type_traits>
 #include <concepts>
 #include <unordered_map>
-#include <unordered_set>
 #include <mutex>
 #include <optional>
+#include <atomic>
+#include <algorithm>
+#include <numeric>
+#include <array>
+#include <deque>
+#include <thread>
+#include <queue>
+#include <memory_resource>
+#include <span>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 
-class RAII_File {
-    FILE* file;
-    public:
-    explicit RAII_File(FILE* file) : file(file) {}
-    ~RAII_File() noexcept {
-        if (file != nullptr) { fclose(file); }
-    }
-
-    void reassign(FILE* set_file) noexcept{
-        if (file == set_file) { return; }
-        if (file != nullptr) { fclose(file); }
-        file = set_file; 
-    }
 
-    RAII_File& operator=(FILE* set_file) noexcept { 
-        if (file == set_file) { return *this; }
-        if (file != nullptr) { fclose(file); }
-        file = set_file; 
-        return *this;
+// Owns a file descriptor for the lifetime of the BufferPool. Opened once, so per page I/O is a single pread/pwrite
+class RAII_FD {
+    int fd;
+    public:
+    explicit RAII_FD(int fd) noexcept : fd(fd) {}
+    ~RAII_FD() noexcept {
+        if (fd >= 0) { close(fd); }
     }
 
-    bool operator==(const void*& ptr) const noexcept {
-        return file == ptr;
-    }
-    // Implicit conversion
-    operator FILE*() const noexcept { return file; }
+    [[nodiscard]] bool valid() const noexcept { return fd >= 0; }
+    [[nodiscard]] int get() const noexcept { return fd; }
 
     // Delete copy operations
-    RAII_File(const RAII_File&) = delete;
-    RAII_File& operator=(const RAII_File&) = delete;
+    RAII_FD(const RAII_FD&) = delete;
+    RAII_FD& operator=(const RAII_FD&) = delete;
 
     // Move constructor
-    RAII_File(RAII_File&& other) noexcept : file(other.file) {
-        other.file = nullptr;  // Transfer ownership
+    RAII_FD(RAII_FD&& other) noexcept : fd(other.fd) {
+        other.fd = -1;  // Transfer ownership
     }
 
     // Move assignment operator
-    RAII_File& operator=(RAII_File&& other) noexcept {
+    RAII_FD& operator=(RAII_FD&& other) noexcept {
         if (this == &other) { return *this; }
-        
-        if (file != nullptr) { fclose(file); }
-    
-        file = other.file;
-        other.file = nullptr;
-        
+
+        if (fd >= 0) { close(fd); }
+
+        fd = other.fd;
+        other.fd = -1;
+
         return *this;
     }
 };
 
+// Snapshot of the BufferPool's disk traffic. syscalls / ops is the number of kernel round trips per page.
+// foreground_writes counts misses that had to write back a dirty victim before their own read, background_writes the
+// pages the background flusher wrote for them ahead of time. prefetch_reads is the part of read_ops done by prefetch() and
+// read-ahead
+struct IOStats {
+    uint64_t read_ops;
+    uint64_t read_syscalls;
+    uint64_t write_ops;
+    uint64_t write_syscalls;
+    uint64_t foreground_writes;
+    uint64_t background_writes;
+    uint64_t prefetch_reads;
+
+    [[nodiscard]] double syscalls_per_read()  const noexcept { return read_ops  == 0 ? 0.0 : static_cast<double>(read_syscalls)  / read_ops; }
+    [[nodiscard]] double syscalls_per_write() const noexcept { return write_ops == 0 ? 0.0 : static_cast<double>(write_syscalls) / write_ops; }
+};
+
 
 
+// Invariant checks run so far (see BufferPoolOptions::invariant_checks) and the frames they looked at. A check scans one
+// shard's frames under its latch, one page table probe each and no allocation, so frames_scanned / checks is the cost of
+// one check and frames_scanned the total. With ALWAYS that's paid by every miss or locked lookup, with SAMPLED by one in
+// invariant_check_interval of them; lock free hits never pay it
+struct InvariantCheckStats {
+    uint64_t checks;
+    uint64_t frames_scanned;
+};
+
+// What the pool did, see BufferPool::stats() (every thread) and BufferPool::thread_stats() (the calling thread only).
+// hits are page requests that found the page resident, misses the ones that read it from disk themselves. One that waited
+// for someone else's read of its page (request_waits / request_wait_ns, the frame_requests wait) hits once it's in, so do
+// pages loaded by prefetch() or a multi page guard. Latch waits only count requests that found the latch taken.
+// page_reads / write_backs are pages moved to and from disk by any path, dirty pages written back for write_backs.
+// hit_latency samples one hit in BufferPoolOptions::stats_hit_sample_interval, the other histograms see everything; disk
+// latencies are per request to the I/O backend, a batch counts once. pinned_frames / dirty_frames are what the pool holds
+// right now, 0 in thread_stats()
+struct BufferPoolStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t page_reads;
+    uint64_t write_backs;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t latch_waits;
+    uint64_t latch_wait_ns;
+    uint64_t request_waits;
+    uint64_t request_wait_ns;
+    size_t pinned_frames;
+    size_t dirty_frames;
+    LatencyHistogram hit_latency;
+    LatencyHistogram miss_latency;
+    LatencyHistogram disk_read_latency;
+    LatencyHistogram disk_write_latency;
+
+    [[nodiscard]] double hit_ratio() const noexcept { return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(hits + misses); }
+};
 
 enum PageGuardFailRC { ok, disk_error, page_in_use, bp_full };
 
+// How often the pool checks its own bookkeeping, see BufferPoolOptions::invariant_checks
+enum class InvariantCheckMode { OFF, SAMPLED, ALWAYS };
+
+// How a read guard's page should be cached.
+// BULK_READ is for one pass scans (validation, analytics): a page it loads recycles through a small ring of frames
+//  (BufferPoolOptions::bulk_read_ring) instead of competing with everything else for the pool, and a page it hits isn't
+//  made to look any hotter. A page from the ring that anything else reads or writes becomes a normal page
+enum class AccessHint { NORMAL, BULK_READ };
+
+struct BufferPoolOptions {
+    // Page table / replacer / free list partitions, each with its own latch. 0 picks one per 64 frames, capped at 64
+    size_t shard_count = 0;
+
+    // Most frames BufferPool::resize() may grow the pool to, 0 for the size it's constructed with. Per frame bookkeeping
+    //  (a few dozen bytes) is sized for this up front, page memory only as the pool grows
+    size_t max_page_count = 0;
+
+    // Background writer, off by default. Wakes every flusher_interval, or as soon as a miss had to write back its victim.
+    //  Once more than flusher_dirty_high of the frames are dirty it writes pages back until under flusher_dirty_low, then
+    //  evicts (clean first, the replacer decides) until flusher_free_target of each shard's frames are free.
+    //  At most flusher_max_writes_per_sec writes a second however often it's kicked, 0 for no limit. Frames in use are skipped, they're likely to be dirtied again
+    bool background_flusher = false;
+    double flusher_dirty_high = 0.20;
+    double flusher_dirty_low  = 0.05;
+    double flusher_free_target = 0.0;
+    size_t flusher_max_writes_per_sec = 0;
+    std::chrono::milliseconds flusher_interval{10};
+
+    // Where the disk I/O goes, see IOBackend.h. io_queue_depth is how many pages go to the backend at once (flush_all), and
+    //  the io_uring ring size. IO_URING falls back to THREAD_POOL when the kernel won't give us a ring
+    IOBackendKind io_backend = IOBackendKind::SYNC;
+    size_t io_queue_depth = 64;
+
+    // File regions checkpoint() / flush_all() write back in parallel, the caller takes one and a long lived pool of
+    //  checkpoint_threads - 1 writers the rest
+    size_t checkpoint_threads = 1;
+
+    // Warm restart, off by default. checkpoint() / flush_all() (so also a clean shutdown) save the resident pids, hottest first
+    //  by the replacer, next to the file (<file>.warm). A pool opened on that file later prefetches them straight away, as many
+    //  as fit, and serves meanwhile. warm_restart_wait makes the constructor wait for them instead
+    bool warm_restart = false;
+    bool warm_restart_wait = false;
+
+    // Frames BULK_READ guards recycle their pages through, split evenly over the shards (at least one each)
+    size_t bulk_read_ring = 16;
+
+    // Threads prefetch() hands its loads to. 0 makes prefetch() load on the calling thread before returning
+    size_t prefetch_workers = 1;
+
+    // Read-ahead, off by default. Once a thread's misses land at a steady stride (1 for a scan, at most 16), the next pages
+    //  of the stream are prefetched. The window starts at read_ahead_min pages and doubles each time the stream catches up
+    //  to half of it, up to read_ahead_max (and never more than a quarter of the pool). Consecutive pages go out as one read
+    size_t read_ahead_min = 4;
+    size_t read_ahead_max = 0;
+
+    // Open the file O_DIRECT and align the frames for it, so a page is cached once (here) instead of twice (here and in the
+    //  OS page cache). page_size must be a multiple of the file's direct I/O alignment. If it isn't, or the filesystem can't
+    //  do direct I/O, the pool says so on stderr and stays buffered, see BufferPool::direct_io()
+    bool direct_io = false;
+
+    // Checks that every resident page maps to exactly one frame and the page table agrees, throwing if not. Done on the
+    //  miss / locked lookup path of a shard: never (OFF), every invariant_check_interval'th time per shard (SAMPLED), or
+    //  every time (ALWAYS, for tests). Costs one pass over the shard's frames, see InvariantCheckStats
+    InvariantCheckMode invariant_checks = InvariantCheckMode::SAMPLED;
+    size_t invariant_check_interval = 1024;
+
+    // One in this many hits is timed for BufferPoolStats::hit_latency, 0 for none. A hit takes tens of ns and reading the
+    //  clock about as long, so timing them all would show up. Everything else that's counted or timed always is
+    size_t stats_hit_sample_interval = 64;
+};
+
 template<typename T>
 concept Allocator = requires(T& alloc, std::size_t n) {
     typename T::value_type;
@@ -81,10 +216,17 @@ concept Allocator = requires(T& alloc, std::size_t n) {
     { alloc.deallocate(std::declval<typename T::value_type*>(), n) } -> std::same_as<void>;
 };
 
-template <Allocator alloc_t = std::allocator<char>>  
+// replacer_t is instantiated with the pool's allocator, i.e. BufferPool<std::allocator<char>, ARCReplacer>
+template <Allocator alloc_t = std::allocator<char>, template <typename> typename replacer_t = LRUKReplacer>
+    requires ReplacementPolicy<replacer_t<alloc_t>>
 class BufferPool {
 
-    enum AccessType { READ, WRITE };
+    enum AccessType { READ, WRITE, PIN }; // PIN: resident and pinned, no latch (PinnedPage)
+
+    // How long get_frame() waits for a frame's latch. Waits on disk I/O aren't bounded by it
+    using Deadline = std::chrono::steady_clock::time_point;
+    static constexpr Deadline NO_DEADLINE = Deadline::max();
+    static constexpr Deadline NO_WAIT = Deadline::min();
 
     alloc_t allocator_{}; 
     using Traits = std::allocator_traits<alloc_t>;
@@ -93,76 +235,487 @@ class BufferPool {
 
     // Rebind allocators for each map's value type
     using FrameIDAllocator             = typename Traits::template rebind_alloc<frame_id_t>;
-    using frame_accesses_Allocator     = typename Traits::template rebind_alloc<std::pair<const frame_id_t, unsigned int>>;
-    using page_to_frame_map_Allocator  = typename Traits::template rebind_alloc<std::pair<const frame_id_t, page_id_t>>;
-    using frame_to_page_map_Allocator  = typename Traits::template rebind_alloc<std::pair<const page_id_t, frame_id_t>>;
+    using PageIDAllocator              = typename Traits::template rebind_alloc<page_id_t>;
+    using IovecAllocator               = typename Traits::template rebind_alloc<iovec>;
+    using IORequestAllocator           = typename Traits::template rebind_alloc<IORequest>;
+    using AtomicPageIDAllocator        = typename Traits::template rebind_alloc<std::atomic<page_id_t>>;
+    using AtomicU32Allocator           = typename Traits::template rebind_alloc<std::atomic<uint32_t>>;
+    using AtomicBoolAllocator          = typename Traits::template rebind_alloc<std::atomic<bool>>;
+    using U32Allocator                 = typename Traits::template rebind_alloc<uint32_t>;
+    using SizeAllocator                = typename Traits::template rebind_alloc<size_t>;
+    using CharPtrAllocator             = typename Traits::template rebind_alloc<char*>;
 
 
     const std::filesystem::path file_path;
-    char* memory;
+    RAII_FD fd;
+    const size_t direct_io_alignment; // 0 if the file goes through the page cache
     const size_t page_size;
-    const size_t page_count;
+    std::atomic<size_t> page_count; // Frames in use, see resize()
+    const BufferPoolOptions options;
+    const size_t max_page_count;
+    // Frame ids are [0, frame_slots), shard i owns the shard_slots of them from i * shard_slots. Only the first
+    //  Shard::frame_count of a shard's slots have memory, the rest wait for resize()
+    const size_t shard_slots;
+    const size_t frame_slots;
+    std::unique_ptr<IOBackend> io;
+
+    // Frame memory is allocated a chunk at a time, the ctor's page_count then one per resize() that grows the pool. A chunk's
+    //  frames are spread over the shards, each on top of the frames the shard already has, so the newest chunk can always be
+    //  taken back out. Remainders go to the shards after the ones the previous chunk's went to, shard sizes differ by one at most
+    struct FrameChunk {
+        char* arena;       // As allocated
+        size_t pages;
+        size_t first_page; // Pool size before it
+    };
+    using FrameChunkAllocator = typename Traits::template rebind_alloc<FrameChunk>;
+    std::mutex resize_mu;
+    std::vector<FrameChunk, FrameChunkAllocator> chunks; // Under resize_mu
+    // Frame -> its memory, aligned to direct_io_alignment. Set before the frame goes on a free list, stale once it's taken off for good
+    std::vector<char*, CharPtrAllocator> frame_memory;
+
+    static constexpr page_id_t INVALID_PID = -1;
+    // Frame -> resident pid, INVALID_PID if none. Written under the frame's shard lock, read lock free to validate a hit
+    std::vector<std::atomic<page_id_t>, AtomicPageIDAllocator> frame_to_page;
+
+    // Frame -> pins held on it by guards, plus short lived ones from lock free readers that haven't validated yet. EVICTING
+    //  is set while the frame is claimed by the evictor or a loader (and on every free frame), a reader that sees it backs off.
+    //  Only ever changed with fetch_add/fetch_sub, except the 0 -> EVICTING claim, so a reader's transient pin is never lost
+    static constexpr uint32_t EVICTING = 1u << 31;
+    std::vector<std::atomic<uint32_t>, AtomicU32Allocator> pin_count;
+    // Frame -> the replacer refused to evict it because it was pinned and pinned it itself, see try_claim() / unpin()
+    std::vector<std::atomic<bool>, AtomicBoolAllocator> parked;
+    // Frame -> modified since it was last written out. Set when a write guard that wrote releases, cleared by whoever writes
+    //  it back (eviction or a flush) while holding the frame's latch or claim
+    std::vector<std::atomic<bool>, AtomicBoolAllocator> dirty;
+    std::atomic<size_t> dirty_count{0};
+    // Frame -> how its page got there, see counts_as_access().
+    // PREFETCHED: loaded by prefetch() or read-ahead and not used since. The load already counted as an access for the
+    //  replacer, so the first guard on it doesn't. Otherwise every scanned page would look like it was accessed twice, and
+    //  LRU-K / ARC would evict the pages just read ahead before the ones the scan is done with.
+    // BULK: loaded by a BULK_READ guard and only used by those since, its frame is in the shard's bulk ring
+    enum FrameOrigin : uint8_t { DEMAND, PREFETCHED, BULK };
+    using AtomicU8Allocator = typename Traits::template rebind_alloc<std::atomic<uint8_t>>;
+    std::vector<std::atomic<uint8_t>, AtomicU8Allocator> origin;
+    std::vector<uint32_t, U32Allocator> frame_shard; // Frame -> index of the shard that owns it
 
-    std::unordered_set<frame_id_t, std::hash<frame_id_t>, std::equal_to<frame_id_t>, FrameIDAllocator> free_frames;
-    std::unordered_map<frame_id_t, unsigned int, std::hash<unsigned int>, std::equal_to<unsigned int>, frame_accesses_Allocator> frame_accesses; // Todo: Decrement when removing page
-    std::unordered_map<frame_id_t, page_id_t, std::hash<frame_id_t>, std::equal_to<frame_id_t>, page_to_frame_map_Allocator> frame_to_page_map;
-    std::unordered_map<page_id_t, frame_id_t, std::hash<page_id_t>, std::equal_to<page_id_t>, frame_to_page_map_Allocator> page_to_frame_map;
-    public:
-    std::mutex mu;
-    private:
+    // So all pages map to the same frame, so different threads don't alloc the same pid to a thousand different frames
+    // pid -> (frame the page is being read into, or written back from by eviction, FrameLock I/O ticket to wait on)
+    struct FrameRequest {
+        frame_id_t frame;
+        uint32_t ticket;
+    };
+    using frame_requests_map_Allocator  = typename Traits::template rebind_alloc<std::pair<const page_id_t, FrameRequest>>;
+    using BulkRingAllocator             = typename Traits::template rebind_alloc<std::pair<frame_id_t, page_id_t>>;
+
+    // A pid belongs to exactly one shard (by hash) and is only ever loaded into that shard's slice of the frames. Each shard
+    //  has its own latch, page table, free list, replacer and in flight requests, so pages in different shards never share a lock.
+    // The page table is also readable without the latch, a hit never takes it (see try_pin_resident())
+    // Replacer works in shard local frame ids (frame - first_frame), go through the helpers
+    struct alignas(64) Shard {
+        std::mutex mu;
+        const frame_id_t first_frame;
+        const size_t max_frames;
+        size_t frame_count = 0; // Frames in use, [first_frame, first_frame + frame_count). Changed under both mu and resize_mu
+        std::vector<frame_id_t, FrameIDAllocator> free_frames;
+        replacer_t<alloc_t> replacer; // Only holds frames with a page in them. Only knows about pins through evict(claim), see try_claim()
+        ConcurrentPageTable<alloc_t> page_table;
+        std::unordered_map<page_id_t, FrameRequest, std::hash<page_id_t>, std::equal_to<page_id_t>, frame_requests_map_Allocator> frame_requests;
+        std::deque<std::pair<frame_id_t, page_id_t>, BulkRingAllocator> bulk_ring; // (frame, pid it was loaded with) oldest first, see recycle_bulk_frame()
+        size_t checks_skipped = 0; // Since the last invariant check, for SAMPLED
+
+        Shard(const frame_id_t first_frame, const size_t max_frames, const alloc_t& alloc)
+            : first_frame(first_frame), max_frames(max_frames), free_frames(FrameIDAllocator(alloc)), replacer(max_frames, alloc),
+              page_table(max_frames, alloc), frame_requests(frame_requests_map_Allocator(alloc)), bulk_ring(BulkRingAllocator(alloc)) {
+            free_frames.reserve(max_frames);
+        }
+
+        void pin(const frame_id_t frame)    { replacer.pin(frame - first_frame); }
+        void unpin(const frame_id_t frame)  { replacer.unpin(frame - first_frame); }
+        void remove(const frame_id_t frame) { replacer.remove(frame - first_frame); }
+        void record_access(const frame_id_t frame, const page_id_t pid) { replacer.record_access(frame - first_frame, pid); }
+
+        template <typename claim_t>
+        [[nodiscard]] auto evict(claim_t&& try_claim) -> std::optional<frame_id_t> {
+            const std::optional<frame_id_t> victim = replacer.evict([&](const frame_id_t local) { return try_claim(local + first_frame); });
+            if (!victim.has_value()) { return std::nullopt; }
+            return victim.value() + first_frame;
+        }
+    };
+    using ShardAllocator = typename Traits::template rebind_alloc<Shard>;
+    std::deque<Shard, ShardAllocator> shards;
+    size_t bulk_ring_capacity = 1; // Per shard, set once the shards exist
+
+    [[nodiscard]] auto shard_index_of(const page_id_t pid) const noexcept -> size_t {
+        // Fibonacci hashing, runs of consecutive pids spread over every shard
+        const uint64_t h = static_cast<uint64_t>(static_cast<uint32_t>(pid)) * 0x9E3779B97F4A7C15ULL;
+        return (h >> 32) % shards.size();
+    }
+
+    [[nodiscard]] auto shard_of(const page_id_t pid) noexcept -> Shard& { return shards[shard_index_of(pid)]; }
+
+    [[nodiscard]] static auto default_shard_count(const size_t page_count) noexcept -> size_t {
+        return std::clamp<size_t>(page_count / 64, 1, 64);
+    }
 
+    [[nodiscard]] static auto shard_count_for(const size_t page_count, const BufferPoolOptions& options) noexcept -> size_t {
+        return std::clamp<size_t>(options.shard_count == 0 ? default_shard_count(page_count) : options.shard_count, 1, std::max<size_t>(page_count, 1));
+    }
+
+    // BP-Wrapper style batching. A lock free hit can't touch the replacer, so it queues (frame, pid) in a per thread buffer
+    //  that is applied under the shard locks when it fills, or when the thread next takes the slow path. An entry whose frame
+    //  has moved on to another page by then is dropped. Tagged with the pool's id, a buffer left over from another pool is discarded
+    struct AccessBatch {
+        uint64_t pool_id = 0;
+        size_t count = 0;
+        std::array<std::pair<frame_id_t, page_id_t>, 32> entries;
+    };
+    static inline thread_local AccessBatch access_batch;
+    static inline std::atomic<uint64_t> next_pool_id{1};
+    const uint64_t pool_id = next_pool_id.fetch_add(1, std::memory_order_relaxed);
+
+    void defer_access(const frame_id_t frame, const page_id_t pid) {
+        AccessBatch& batch = access_batch;
+        if (batch.pool_id != pool_id) {
+            batch.pool_id = pool_id;
+            batch.count = 0;
+        }
+        batch.entries[batch.count++] = {frame, pid};
+        if (batch.count == batch.entries.size()) { flush_access_batch(); }
+    }
 
-    void sanity_check(std::unique_lock<std::mutex>& bp_lock) {
-        STACK_TRACE_ASSERT(bp_lock.owns_lock());
-        std::unordered_set<page_id_t> unique_pages;
-        for (const auto& p : frame_to_page_map) {
-            const page_id_t pid = p.second;
-            if (unique_pages.contains(pid)) {
-                FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("BP.frame_to_page_map contained multiple page to frame mappings. Supposed to be unique. i.e. 1 page -> 1 frame. Found n pages -> 1 frame");
+    void flush_access_batch() { // No locks held
+        AccessBatch& batch = access_batch;
+        if (batch.pool_id != pool_id) { return; }
+
+        // One lock per shard in the batch, entries of a shard are applied in the order they happened
+        for (size_t i = 0; i < batch.count; i++) {
+            if (batch.entries[i].first == -1) { continue; }
+            const uint32_t shard_index = frame_shard[batch.entries[i].first];
+            Shard& shard = shards[shard_index];
+            std::lock_guard lock(shard.mu);
+            for (size_t j = i; j < batch.count; j++) {
+                auto& [frame, pid] = batch.entries[j];
+                if (frame == -1 || frame_shard[frame] != shard_index) { continue; }
+                if (frame_to_page[frame].load(std::memory_order_relaxed) == pid) { shard.record_access(frame, pid); }
+                frame = -1;
             }
-            unique_pages.emplace(pid);
         }
+        batch.count = 0;
+    }
+
+    // Read-ahead state of the calling thread, see BufferPoolOptions::read_ahead_max. Tagged with the pool's id like AccessBatch.
+    // Only slow path accesses (misses, or pages still on their way in) can start a stream or break it. Once one is running
+    //  its pages mostly hit, so hits move it along too, and a hit off the stream (say an inner node of the tree being
+    //  scanned) is ignored
+    struct ReadAheadStream {
+        uint64_t pool_id = 0;
+        int64_t last = -1;   // Last pid of the stream
+        int64_t stride = 0;  // 0 while there's no stream
+        uint32_t run = 0;    // Accesses in a row at stride
+        size_t window = 0;   // 0 until the stream is confirmed
+        int64_t ahead = 0;   // Furthest pid already read ahead
+        // Where the stream is, for read-ahead still queued on the prefetch worker. A worker that falls behind skips the pages
+        //  the stream went past (the thread loaded them itself) instead of reading them again after they were evicted
+        std::shared_ptr<std::atomic<int64_t>> position;
+    };
+    static inline thread_local ReadAheadStream read_ahead;
+    static constexpr int64_t MAX_READ_AHEAD_STRIDE = 16;
+
+    void note_access(const page_id_t pid, const bool slow_path) {
+        if (options.read_ahead_max == 0) { return; }
+        ReadAheadStream& stream = read_ahead;
+        if (stream.pool_id != pool_id) {
+            stream = ReadAheadStream{};
+            stream.pool_id = pool_id;
+        }
+
+        const int64_t delta = static_cast<int64_t>(pid) - stream.last;
+        if (stream.stride == 0 || delta != stream.stride) {
+            if (!slow_path) { return; }
+            const bool strided = stream.last != -1 && delta != 0 && -MAX_READ_AHEAD_STRIDE <= delta && delta <= MAX_READ_AHEAD_STRIDE;
+            stream = ReadAheadStream{};
+            stream.pool_id = pool_id;
+            stream.last = pid;
+            stream.stride = strided ? delta : 0;
+            stream.run = 1;
+            return;
+        }
+        stream.last = pid;
+        stream.run++;
+        if (stream.position != nullptr) { stream.position->store(pid, std::memory_order_relaxed); }
+        if (stream.run < 2) { return; } // One stride could be chance
+
+        // Linux style. A miss on the stream reads itself and the window after it in one go on this thread (the pages come
+        //  off disk as one read). Once the stream is within half a window of what was read ahead, the window doubles and the
+        //  next one goes to the prefetch worker, so a scan that keeps up never blocks. A miss inside the read ahead range
+        //  means the worker is behind, the thread then loads what's left of the range itself
+        const size_t max_window = std::max<size_t>(std::min(options.read_ahead_max, capacity() / 4), 1);
+        const bool confirmed = stream.window != 0;
+        const int64_t lead = confirmed ? (stream.ahead - pid) / stream.stride : -1; // Pages of the stream read ahead of pid
+        const bool top_up = lead <= static_cast<int64_t>(stream.window / 2);
+        if (!slow_path && (!top_up || lead < 0)) { return; }
+
+        int64_t target = stream.ahead;
+        if (top_up) {
+            stream.window = confirmed ? std::min(stream.window * 2, max_window) : std::min(std::max<size_t>(options.read_ahead_min, 1), max_window);
+            target = pid + static_cast<int64_t>(stream.window) * stream.stride;
+        }
+        const int64_t first = slow_path ? pid : stream.ahead + stream.stride;
+
+        std::vector<page_id_t, PageIDAllocator> pids{PageIDAllocator(allocator_)};
+        pids.reserve(stream.window + 1);
+        for (int64_t next = first; stream.stride > 0 ? next <= target : next >= target; next += stream.stride) {
+            if (next < 0 || next > std::numeric_limits<page_id_t>::max()) { break; }
+            pids.push_back(static_cast<page_id_t>(next));
+        }
+        stream.ahead = target;
+        if (slow_path || !prefetcher.has_value()) {
+            load_unpinned(pids);
+            return;
+        }
+        if (stream.position == nullptr) { stream.position = std::make_shared<std::atomic<int64_t>>(pid); }
+        give_prefetch([this, pids = std::move(pids), position = stream.position, stride = stream.stride]() {
+            const int64_t at = position->load(std::memory_order_relaxed);
+            const auto first = std::find_if(pids.begin(), pids.end(), [&](const page_id_t next) { return stride > 0 ? next > at : next < at; });
+            this->load_unpinned({first, pids.end()});
+        });
+    }
+
+    // Relaxed, only read through io_stats()
+    std::atomic<uint64_t> read_ops{0};
+    std::atomic<uint64_t> read_syscalls{0};
+    std::atomic<uint64_t> write_ops{0};
+    std::atomic<uint64_t> write_syscalls{0};
+    std::atomic<uint64_t> foreground_writes{0};
+    std::atomic<uint64_t> background_writes{0};
+    std::atomic<uint64_t> prefetch_reads{0};
+
+    // Background flusher state, see BufferPoolOptions. Runs as a single long lived task on its own ThreadPool. std::allocator,
+    //  ThreadPool caches its task allocator per thread and type, a pool allocator could outlive its resource there
+    std::mutex flusher_mu;
+    std::condition_variable flusher_cv;
+    bool flusher_stop = false;
+    std::atomic<bool> flusher_kick{false};
+    frame_id_t flusher_cursor = 0; // Flusher thread only
+    // Token bucket behind flusher_max_writes_per_sec, flusher thread only. Refilled by the time since the last cycle, kicked
+    //  or not, and holds at most a flusher_interval worth of writes (one at least)
+    double flusher_tokens = 0.0;
+    std::chrono::steady_clock::time_point flusher_refilled = std::chrono::steady_clock::now();
+    std::optional<ThreadPool<>> flusher;
+
+    // Runs prefetch() loads, std::allocator for the same reason as the flusher's
+    std::optional<ThreadPool<>> prefetcher;
+    // Loads given to prefetcher and not done yet. wait_for_prefetches() sleeps on it, the last one out notifies
+    std::atomic<uint32_t> prefetches_pending{0};
+
+    template <typename Func>
+    void give_prefetch(Func&& load) {
+        prefetches_pending.fetch_add(1, std::memory_order_relaxed);
+        prefetcher->give_work([this, load = std::forward<Func>(load)]() mutable {
+            load();
+            if (prefetches_pending.fetch_sub(1, std::memory_order_release) == 1) { prefetches_pending.notify_all(); }
+        });
+    }
+
+    // Writes checkpoint() regions besides the caller's own, checkpoint_threads - 1 workers. Only there if checkpoint_threads > 1
+    std::optional<ThreadPool<>> checkpoint_writers;
+
+
+    // Counters behind stats(). Every thread gets a block of its own in each pool it uses, found through a small thread_local
+    //  cache of (pool id, block), so a thread going back and forth between a few pools never takes stats_mu. Only the owner
+    //  writes a block, so counting is a plain load and store, see SingleWriterCounter. Blocks outlive their threads, so
+    //  nothing counted is lost
+    struct alignas(64) ThreadStats {
+        const std::thread::id owner;
+        SingleWriterCounter hits, misses, evictions, page_reads, write_backs, latch_waits, latch_wait_ns, request_waits, request_wait_ns;
+        LatencyRecorder hit_latency, miss_latency, disk_read_latency, disk_write_latency;
+        size_t hits_since_sample = 0;
+
+        explicit ThreadStats(const std::thread::id owner) noexcept : owner(owner) {}
+    };
+    using ThreadStatsAllocator = typename Traits::template rebind_alloc<ThreadStats>;
+    mutable std::mutex stats_mu;
+    std::deque<ThreadStats, ThreadStatsAllocator> thread_stats_blocks{ThreadStatsAllocator(allocator_)}; // Deque, blocks never move
+
+    // Pool ids are never reused, so an entry for a pool that's gone is never matched again and just ages out
+    struct ThreadStatsCache {
+        static constexpr size_t WAYS = 8;
+        std::array<std::pair<uint64_t, ThreadStats*>, WAYS> entries{}; // (pool id, its block), 0 is no pool
+        size_t next = 0; // Round robin replacement
+    };
+    static inline thread_local ThreadStatsCache thread_stats_cache;
+
+    [[nodiscard]] auto my_stats() -> ThreadStats& {
+        ThreadStatsCache& cache = thread_stats_cache;
+        for (const auto& [id, stats] : cache.entries) {
+            if (id == pool_id) { return *stats; }
+        }
+        std::lock_guard lock(stats_mu);
+        const std::thread::id me = std::this_thread::get_id();
+        const auto it = std::find_if(thread_stats_blocks.begin(), thread_stats_blocks.end(), [me](const ThreadStats& stats) { return stats.owner == me; });
+        ThreadStats& stats = it != thread_stats_blocks.end() ? *it : thread_stats_blocks.emplace_back(me);
+        cache.entries[cache.next] = {pool_id, &stats};
+        cache.next = (cache.next + 1) % ThreadStatsCache::WAYS;
+        return stats;
+    }
+
+    // Whether the caller's next hit will be timed, without counting one
+    [[nodiscard]] auto hit_sample_due(const ThreadStats& stats) const noexcept -> bool {
+        return options.stats_hit_sample_interval != 0 && stats.hits_since_sample + 1 >= options.stats_hit_sample_interval;
+    }
+
+    // Counts a hit, true if it's the one to time, see BufferPoolOptions::stats_hit_sample_interval. Only called on hits
+    [[nodiscard]] auto sample_hit(ThreadStats& stats) const noexcept -> bool {
+        if (options.stats_hit_sample_interval == 0 || ++stats.hits_since_sample < options.stats_hit_sample_interval) { return false; }
+        stats.hits_since_sample = 0;
+        return true;
+    }
+
+    void add_stats(BufferPoolStats& total, const ThreadStats& stats) const noexcept {
+        total.hits += stats.hits.load();
+        total.misses += stats.misses.load();
+        total.evictions += stats.evictions.load();
+        total.page_reads += stats.page_reads.load();
+        total.write_backs += stats.write_backs.load();
+        total.bytes_read += stats.page_reads.load() * page_size;
+        total.bytes_written += stats.write_backs.load() * page_size;
+        total.latch_waits += stats.latch_waits.load();
+        total.latch_wait_ns += stats.latch_wait_ns.load();
+        total.request_waits += stats.request_waits.load();
+        total.request_wait_ns += stats.request_wait_ns.load();
+        stats.hit_latency.add_to(total.hit_latency);
+        stats.miss_latency.add_to(total.miss_latency);
+        stats.disk_read_latency.add_to(total.disk_read_latency);
+        stats.disk_write_latency.add_to(total.disk_write_latency);
+    }
+
+    std::atomic<uint64_t> invariant_checks{0};
+    std::atomic<uint64_t> invariant_check_frames{0};
+
+    // Per options.invariant_checks
+    void sanity_check(Shard& shard, std::unique_lock<std::mutex>& shard_lock) {
+        STACK_TRACE_ASSERT(shard_lock.owns_lock());
+        switch (options.invariant_checks) {
+            case InvariantCheckMode::OFF: return;
+            case InvariantCheckMode::SAMPLED:
+                if (++shard.checks_skipped < options.invariant_check_interval) { return; }
+                shard.checks_skipped = 0;
+                break;
+            case InvariantCheckMode::ALWAYS: break;
+        }
+        check_invariants(shard);
+    }
+
+    // Shard lock held. A page in two frames can't have the page table point at both, so checking every frame against the
+    //  table and the counts against each other finds it without a set of the pids seen
+    void check_invariants(const Shard& shard) {
+        size_t resident = 0;
+        for (size_t i = 0; i < shard.frame_count; i++) {
+            const frame_id_t frame = shard.first_frame + static_cast<frame_id_t>(i);
+            const page_id_t pid = frame_to_page[frame].load(std::memory_order_relaxed);
+            if (pid == INVALID_PID) { continue; }
+            resident++;
+            if (shard.page_table.find(pid) != frame) {
+                FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("BufferPool: frame (" + std::to_string(frame) + ") holds pid (" + std::to_string(pid) + ") but the page table maps it to frame ("
+                    + std::to_string(shard.page_table.find(pid)) + "). Supposed to be unique. i.e. 1 page -> 1 frame");
+            }
+        }
+        if (resident != shard.page_table.size()) {
+            FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("BufferPool: (" + std::to_string(resident) + ") resident frames but (" + std::to_string(shard.page_table.size()) + ") page table entries");
+        }
+        invariant_checks.fetch_add(1, std::memory_order_relaxed);
+        invariant_check_frames.fetch_add(shard.frame_count, std::memory_order_relaxed);
     }
 
-    static constexpr unsigned int k = 2;
 
     class FrameLock {
-        using shared_mutexAllocator = typename Traits::template rebind_alloc<std::shared_mutex>;
-        using AtomicIntAllocator    = typename Traits::template rebind_alloc<std::atomic<int>>;
+        using HybridLatchAllocator = typename Traits::template rebind_alloc<HybridLatch>;
 
         BufferPool& bp;
-        std::vector<std::shared_mutex, shared_mutexAllocator> frame_mu;        // Frame -> Read mutex
-        std::vector<std::atomic<int>, AtomicIntAllocator> write_requests; // So the retard doesn't free an inuse frame AND so lock doesn't block
-        std::vector<std::atomic<int>, AtomicIntAllocator> read_requests; // So the retard doesn't free an inuse frame AND so lock doesn't block
+        std::vector<HybridLatch, HybridLatchAllocator> frame_mu; // Frame -> latch, see HybridLatch.h
+
+        // Frame -> completion word for the disk read in flight into it. Low 2 bits are the IOStatus, the rest is a generation
+        // bumped per load, so a waiter on an old load can't mistake a newer load of the same frame for its own
+        enum IOStatus : uint32_t { IO_DONE = 0, IO_PENDING = 1, IO_FAILED = 2 };
+        static constexpr uint32_t io_status_mask = 0b11;
+        using AtomicUIntAllocator = typename Traits::template rebind_alloc<std::atomic<uint32_t>>;
+        std::vector<std::atomic<uint32_t>, AtomicUIntAllocator> io_word;
 
         public:
-        explicit FrameLock(BufferPool& bp) : bp(bp), frame_mu(bp.page_count), write_requests(bp.page_count), read_requests(bp.page_count) {}
+        explicit FrameLock(BufferPool& bp) : bp(bp), frame_mu(bp.frame_slots), io_word(bp.frame_slots) {}
+
+        // Must be called with shard_lock held, before the request is visible. Returns the ticket waiters block on
+        [[nodiscard]] auto begin_io(const frame_id_t frame, std::unique_lock<std::mutex>& shard_lock) -> uint32_t {
+            STACK_TRACE_ASSERT(shard_lock.owns_lock());
+            const uint32_t generation = (io_word[frame].load(std::memory_order_relaxed) & ~io_status_mask) + (io_status_mask + 1);
+            const uint32_t ticket = generation | IO_PENDING;
+            io_word[frame].store(ticket, std::memory_order_relaxed);
+            return ticket;
+        }
+
+        // Wakes every waiter on the ticket exactly once
+        void end_io(const frame_id_t frame, const uint32_t ticket, const bool ok) {
+            io_word[frame].store((ticket & ~io_status_mask) | (ok ? IO_DONE : IO_FAILED), std::memory_order_release);
+            io_word[frame].notify_all();
+        }
+
+        // Blocks (no spinning, futex backed) until the load behind ticket completes. Must not hold the shard lock. False if the read failed
+        [[nodiscard]] auto wait_io(const frame_id_t frame, const uint32_t ticket) -> bool {
+            io_word[frame].wait(ticket, std::memory_order_acquire);
+            const uint32_t word = io_word[frame].load(std::memory_order_acquire);
+            const bool same_load = (word & ~io_status_mask) == (ticket & ~io_status_mask);
+            return !(same_load && (word & io_status_mask) == IO_FAILED);
+        }
 
-        void write_lock_frame(const frame_id_t frame, std::unique_lock<std::mutex>& bp_lock) {
-            STACK_TRACE_ASSERT(bp_lock.owns_lock());
-            write_requests[frame].fetch_add(1);
-            bp_lock.unlock();
-            frame_mu[frame].lock(); // Might need to be a try_lock() in the future and let the called deal with it
-            bp_lock.lock();
-            write_requests[frame].fetch_sub(1);
+        // Never called with a shard lock held. Caller holds a pin, so the frame can't be evicted while we block.
+        //  Only a latch that turns out to be taken costs a clock read, for the latch wait stats
+        void write_lock_frame(const frame_id_t frame) {
+            if (frame_mu[frame].try_lock()) { return; }
+            const auto start = std::chrono::steady_clock::now();
+            frame_mu[frame].lock();
+            note_wait(start);
         }
 
-        void read_lock_frame(const frame_id_t frame, std::unique_lock<std::mutex>& bp_lock) {
-            STACK_TRACE_ASSERT(bp_lock.owns_lock());
-            read_requests[frame].fetch_add(1);
-            bp_lock.unlock();
-            frame_mu[frame].lock_shared(); // Might need to be a try_lock() in the future and let the called deal with it
-            bp_lock.lock();
-            read_requests[frame].fetch_sub(1);
+        void read_lock_frame(const frame_id_t frame) {
+            if (frame_mu[frame].try_lock_shared()) { return; }
+            const auto start = std::chrono::steady_clock::now();
+            frame_mu[frame].lock_shared();
+            note_wait(start);
         }
 
-        void lock_frame(const frame_id_t frame, const AccessType access_type, std::unique_lock<std::mutex>& bp_lock) {
+        void note_wait(const std::chrono::steady_clock::time_point start) {
+            ThreadStats& stats = bp.my_stats();
+            stats.latch_waits.add();
+            stats.latch_wait_ns.add(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()));
+        }
+
+        [[nodiscard]] auto try_read_lock_frame(const frame_id_t frame) -> bool {
+            return frame_mu[frame].try_lock_shared();
+        }
+
+        void lock_frame(const frame_id_t frame, const AccessType access_type) {
             switch (access_type) {
-                case READ:  read_lock_frame(frame, bp_lock);  break;
-                case WRITE: write_lock_frame(frame, bp_lock); break;
+                case READ:  read_lock_frame(frame);  break;
+                case WRITE: write_lock_frame(frame); break;
+                case PIN:   break;
             }  
         }
 
+        // Gives up at deadline, NO_WAIT tries once. NO_DEADLINE blocks like lock_frame()
+        [[nodiscard]] auto lock_frame_until(const frame_id_t frame, const AccessType access_type, const Deadline deadline) -> bool {
+            if (deadline == NO_DEADLINE) {
+                lock_frame(frame, access_type);
+                return true;
+            }
+            const auto try_once = [&]() { return access_type == READ ? frame_mu[frame].try_lock_shared() : frame_mu[frame].try_lock(); };
+            if (access_type == PIN || try_once()) { return true; }
+            if (deadline == NO_WAIT) { return false; }
+            const auto start = std::chrono::steady_clock::now();
+            const bool locked = access_type == READ ? frame_mu[frame].try_lock_shared_until(deadline) : frame_mu[frame].try_lock_until(deadline);
+            note_wait(start);
+            return locked;
+        }
+
         void write_unlock_frame(const frame_id_t frame) {
             frame_mu[frame].unlock();
         }
@@ -171,43 +724,230 @@ class BufferPool {
             frame_mu[frame].unlock_shared();
         }
 
+        // Read latch -> write latch, only if the caller is the frame's one reader. Never blocks, see HybridLatch::try_upgrade()
+        [[nodiscard]] auto try_upgrade_frame(const frame_id_t frame) -> bool {
+            return frame_mu[frame].try_upgrade();
+        }
+
+        // Write latch -> read latch
+        void downgrade_frame(const frame_id_t frame) {
+            frame_mu[frame].downgrade();
+        }
+
+        [[nodiscard]] auto latch(const frame_id_t frame) const -> const HybridLatch& { return frame_mu[frame]; }
+
         void unlock_frame(const frame_id_t frame, const AccessType access_type) {
             switch (access_type) {
                 case READ:  read_unlock_frame(frame);  break;
                 case WRITE: write_unlock_frame(frame); break;
+                case PIN:   break;
             }  
         }
+    };
+    FrameLock frame_lock;
 
-        [[nodiscard]] auto is_locked(const frame_id_t frame) -> bool {
-            if (write_requests[frame].load() != 0 || read_requests[frame].load() != 0) {
-                return true;
+
+    // Alignment O_DIRECT wants of buffers, offsets and lengths on fd, after turning it on. 0 if it can't be, with the reason
+    //  on stderr, the pool then runs buffered
+    [[nodiscard]] static auto enable_direct_io(const RAII_FD& fd, const std::filesystem::path& file_path, const size_t page_size) -> size_t {
+        if (!fd.valid()) { return 0; } // Reported by the ctor
+        size_t alignment = 0;
+#ifdef STATX_DIOALIGN
+        struct statx stx{};
+        if (statx(fd.get(), "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 && (stx.stx_mask & STATX_DIOALIGN) != 0) {
+            if (stx.stx_dio_mem_align == 0) {
+                std::cerr << "BufferPool: (" << file_path.string() << ") doesn't support direct I/O, using the page cache\n";
+                return 0;
+            }
+            alignment = std::max(stx.stx_dio_mem_align, stx.stx_dio_offset_align);
+        }
+#endif
+        if (alignment == 0) { // Kernel too old to tell us, the filesystem block size is always enough
+            struct stat st{};
+            if (fstat(fd.get(), &st) != 0) {
+                perror("BufferPool: fstat");
+                return 0;
+            }
+            alignment = static_cast<size_t>(st.st_blksize);
+        }
+        if (page_size % alignment != 0) {
+            std::cerr << "BufferPool: page size (" << page_size << ") isn't a multiple of the direct I/O alignment (" << alignment
+                      << ") of (" << file_path.string() << "), using the page cache\n";
+            return 0;
+        }
+        const int flags = fcntl(fd.get(), F_GETFL);
+        if (flags < 0 || fcntl(fd.get(), F_SETFL, flags | O_DIRECT) < 0) {
+            std::cerr << "BufferPool: can't open (" << file_path.string() << ") O_DIRECT (" << std::strerror(errno) << "), using the page cache\n";
+            return 0;
+        }
+        return alignment;
+    }
+
+    [[nodiscard]] static auto arena_size(const size_t page_size, const size_t page_count, const size_t alignment) noexcept -> size_t {
+        return page_size * page_count + (alignment == 0 ? 0 : alignment - 1);
+    }
+
+    [[nodiscard]] static auto align_arena(char* const arena, const size_t alignment) noexcept -> char* {
+        if (alignment == 0) { return arena; }
+        const auto address = reinterpret_cast<uintptr_t>(arena);
+        return arena + ((alignment - address % alignment) % alignment);
+    }
+
+    // How many of the chunk's frames shard i gets, see FrameChunk
+    [[nodiscard]] auto chunk_frames(const FrameChunk& chunk, const size_t i) const noexcept -> size_t {
+        const size_t shard_count = shards.size();
+        const size_t after_start = (i + shard_count - chunk.first_page % shard_count) % shard_count;
+        return chunk.pages / shard_count + (after_start < chunk.pages % shard_count ? 1 : 0);
+    }
+
+    // Puts the count slots after shard's frames in use on its free list. Their memory must already be set
+    void extend_shard(Shard& shard, const size_t count) {
+        std::lock_guard lock(shard.mu);
+        for (size_t i = count; i > 0; i--) { // Lowest frame ends up on top
+            shard.free_frames.push_back(shard.first_frame + static_cast<frame_id_t>(shard.frame_count + i - 1));
+        }
+        shard.frame_count += count;
+    }
+
+    // Under resize_mu (or in the ctor). Throws what the allocator throws, with nothing changed
+    void add_chunk(const size_t pages) {
+        chunks.reserve(chunks.size() + 1);
+        const FrameChunk chunk{Traits::allocate(allocator_, arena_size(page_size, pages, direct_io_alignment)), pages, page_count.load(std::memory_order_relaxed)};
+        chunks.push_back(chunk);
+
+        char* next = align_arena(chunk.arena, direct_io_alignment);
+        for (size_t i = 0; i < shards.size(); i++) {
+            const size_t count = chunk_frames(chunk, i);
+            for (size_t j = 0; j < count; j++) {
+                frame_memory[shards[i].first_frame + static_cast<frame_id_t>(shards[i].frame_count + j)] = next;
+                next += page_size;
             }
+            extend_shard(shards[i], count);
+        }
+        page_count.fetch_add(pages, std::memory_order_relaxed);
+    }
 
-            if (frame_mu[frame].try_lock()) {
-                frame_mu[frame].unlock();
+    // Takes shard i's share of the newest chunk (its top frames) out of use. Every one of them must be free, or resident,
+    //  clean and unpinned, otherwise nothing changes and it's false. Under resize_mu
+    [[nodiscard]] auto shrink_shard(const size_t i) -> bool {
+        Shard& shard = shards[i];
+        const size_t count = chunk_frames(chunks.back(), i);
+        std::lock_guard lock(shard.mu);
+        const frame_id_t end = shard.first_frame + static_cast<frame_id_t>(shard.frame_count);
+        const frame_id_t begin = end - static_cast<frame_id_t>(count);
+        const auto in_chunk = [&](const frame_id_t frame) { return frame >= begin && frame < end; };
+
+        // Free ones to the back, sorted so the rest can be told apart
+        const auto free_in_chunk = std::partition(shard.free_frames.begin(), shard.free_frames.end(), [&](const frame_id_t frame) { return !in_chunk(frame); });
+        std::sort(free_in_chunk, shard.free_frames.end());
+
+        std::vector<frame_id_t, FrameIDAllocator> claimed{FrameIDAllocator(allocator_)};
+        for (frame_id_t frame = begin; frame < end; frame++) {
+            if (std::binary_search(free_in_chunk, shard.free_frames.end(), frame)) { continue; }
+            uint32_t expected = 0;
+            const bool claim = pin_count[frame].compare_exchange_strong(expected, EVICTING); // Fails on pins and on loads / write backs in flight
+            if (claim) { claimed.push_back(frame); }
+            if (!claim || dirty[frame].load()) {
+                for (const frame_id_t undo : claimed) { pin_count[undo].fetch_sub(EVICTING); }
                 return false;
-            } else {
-                return true;
             }
         }
-    };
-    FrameLock frame_lock;
 
+        // Claimed frames hold clean pages, dropping them is all eviction would do. Left free, minus the free list
+        for (const frame_id_t frame : claimed) {
+            shard.page_table.erase(frame_to_page[frame].load(std::memory_order_relaxed));
+            if (parked[frame].exchange(false)) { shard.unpin(frame); } // The replacer still has it pinned
+            shard.remove(frame);
+            frame_to_page[frame].store(INVALID_PID, std::memory_order_relaxed);
+            origin[frame].store(DEMAND, std::memory_order_relaxed);
+        }
+        std::erase_if(shard.bulk_ring, [&](const auto& entry) { return in_chunk(entry.first); });
+        shard.free_frames.erase(free_in_chunk, shard.free_frames.end());
+        shard.frame_count -= count;
+        return true;
+    }
+
+    // Frees the newest chunk. Its dirty pages are written back first, then its frames come out of every shard, or of none if
+    //  one of them is in use. Under resize_mu
+    [[nodiscard]] auto remove_chunk() -> bool {
+        const FrameChunk chunk = chunks.back();
+        for (size_t i = 0; i < shards.size(); i++) {
+            const size_t count = chunk_frames(chunk, i);
+            const size_t end = static_cast<size_t>(shards[i].first_frame) + shards[i].frame_count;
+            for (size_t frame = end - count; frame < end; frame++) {
+                if (!dirty[frame].load(std::memory_order_relaxed)) { continue; }
+                const page_id_t pid = frame_to_page[frame].load(std::memory_order_acquire);
+                if (pid != INVALID_PID) { [[maybe_unused]] const bool written = flush_page(pid); } // A failure leaves it dirty, caught below
+            }
+        }
+
+        for (size_t i = 0; i < shards.size(); i++) {
+            if (shrink_shard(i)) { continue; }
+            for (size_t j = 0; j < i; j++) { extend_shard(shards[j], chunk_frames(chunk, j)); } // Memory's still there
+            return false;
+        }
+        Traits::deallocate(allocator_, chunk.arena, arena_size(page_size, chunk.pages, direct_io_alignment));
+        chunks.pop_back();
+        page_count.fetch_sub(chunk.pages, std::memory_order_relaxed);
+        return true;
+    }
 
     public:
-    explicit BufferPool(const std::filesystem::path file_path, const size_t page_size, const size_t page_count, alloc_t allocator = alloc_t{}) 
-        : allocator_(allocator), file_path(file_path), memory(Traits::allocate(allocator_, page_size * page_count)), page_size(page_size), page_count(page_count), frame_lock(*this),
-        free_frames(page_count, allocator), frame_accesses(page_count, allocator), page_to_frame_map(allocator), frame_to_page_map(page_count, allocator) 
+    explicit BufferPool(const std::filesystem::path file_path, const size_t page_size, const size_t page_count, alloc_t allocator = alloc_t{}, const BufferPoolOptions options = {}) 
+        : allocator_(allocator), file_path(file_path), fd(open(file_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644)),
+        direct_io_alignment(options.direct_io ? enable_direct_io(fd, file_path, page_size) : 0),
+        page_size(page_size), page_count(0), options(options), max_page_count(std::max(options.max_page_count, page_count)),
+        shard_slots((max_page_count + shard_count_for(page_count, options) - 1) / shard_count_for(page_count, options)),
+        frame_slots(shard_slots * shard_count_for(page_count, options)), io(make_io_backend(options.io_backend, options.io_queue_depth)),
+        chunks(FrameChunkAllocator(allocator)), frame_memory(frame_slots, nullptr, CharPtrAllocator(allocator)),
+        frame_to_page(frame_slots, AtomicPageIDAllocator(allocator)), pin_count(frame_slots, AtomicU32Allocator(allocator)), parked(frame_slots, AtomicBoolAllocator(allocator)),
+        dirty(frame_slots, AtomicBoolAllocator(allocator)), origin(frame_slots, AtomicU8Allocator(allocator)),
+        frame_shard(frame_slots, 0, U32Allocator(allocator)), shards(ShardAllocator(allocator)), frame_lock(*this)
         {
-            for (size_t i = 0; i < page_count; i++) {
-                free_frames.emplace(i);
-                frame_accesses.insert_or_assign(i, 0);
+            if (!fd.valid()) {
+                perror("open");
+                FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("BufferPool: failed to open (" + file_path.string() + ")");
+            }
+            if (page_count == 0) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("BufferPool: page_count must be > 0"); }
+
+            const size_t shard_count = frame_slots / shard_slots;
+            for (size_t i = 0; i < shard_count; i++) {
+                const auto first_frame = static_cast<frame_id_t>(i * shard_slots);
+                shards.emplace_back(first_frame, shard_slots, allocator);
+                for (size_t j = 0; j < shard_slots; j++) { frame_shard[first_frame + j] = static_cast<uint32_t>(i); }
+            }
+            for (size_t frame = 0; frame < frame_slots; frame++) {
+                frame_to_page[frame].store(INVALID_PID, std::memory_order_relaxed);
+                pin_count[frame].store(EVICTING, std::memory_order_relaxed); // Free
+                parked[frame].store(false, std::memory_order_relaxed);
+                dirty[frame].store(false, std::memory_order_relaxed);
+                origin[frame].store(DEMAND, std::memory_order_relaxed);
+            }
+            add_chunk(page_count);
+            bulk_ring_capacity = std::max<size_t>(options.bulk_read_ring / shards.size(), 1);
+
+            if (options.background_flusher) {
+                flusher.emplace(1);
+                flusher->give_work([this]() { this->flusher_loop(); });
             }
+            if (options.prefetch_workers > 0) { prefetcher.emplace(options.prefetch_workers); }
+            if (options.checkpoint_threads > 1) { checkpoint_writers.emplace(options.checkpoint_threads - 1); }
+            if (options.warm_restart) { prewarm(); }
         }
 
     ~BufferPool() {
-        if (memory != nullptr) {
-            std::allocator_traits<alloc_t>::deallocate(allocator_, memory, page_size * page_count);
+        prefetcher.reset(); // Joins, prefetches still queued are dropped
+        if (flusher.has_value()) {
+            {
+                std::lock_guard lock(flusher_mu);
+                flusher_stop = true;
+            }
+            flusher_cv.notify_all();
+            flusher.reset(); // Joins
+        }
+        [[maybe_unused]] const bool flushed = flush_all(); // Failures were already reported by disk_write, nothing else to do with them here
+        for (const FrameChunk& chunk : chunks) {
+            std::allocator_traits<alloc_t>::deallocate(allocator_, chunk.arena, arena_size(page_size, chunk.pages, direct_io_alignment));
         }
     }
 
@@ -218,185 +958,1017 @@ class BufferPool {
 
     public:
 
-    auto disk_write(const Page page, std::unique_lock<std::mutex>& bp_lock) -> bool { // Lock must be held
-        STACK_TRACE_ASSERT(bp_lock.owns_lock());
-
-        RAII_File file = RAII_File{fopen(file_path.c_str(), "rb+")};
-        if (file == nullptr) { return false; }
-        
-        const unsigned int file_offset = page.pid * page_size;
-        if (fseek(file, file_offset, SEEK_SET) != 0) {
-            perror("fseek failed");
-            return false;
+    // One page through the I/O backend. Bytes transferred (short only for a read past EOF), -1 on failure (already reported)
+    [[nodiscard]] auto page_io(const IORequest::Op op, const page_id_t pid, char* const data) -> ssize_t {
+        iovec iov{data, page_size};
+        IORequest req{op, fd.get(), static_cast<off_t>(pid) * static_cast<off_t>(page_size), &iov, 1};
+        const auto start = std::chrono::steady_clock::now();
+        const uint64_t syscalls = io->submit_and_wait({&req, 1});
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        ThreadStats& stats = my_stats();
+        if (op == IORequest::READ) {
+            read_ops.fetch_add(1, std::memory_order_relaxed);
+            read_syscalls.fetch_add(syscalls, std::memory_order_relaxed);
+            stats.page_reads.add();
+            stats.disk_read_latency.record(elapsed);
+        } else {
+            write_ops.fetch_add(1, std::memory_order_relaxed);
+            write_syscalls.fetch_add(syscalls, std::memory_order_relaxed);
+            stats.write_backs.add();
+            stats.disk_write_latency.record(elapsed);
+        }
+        if (req.result < 0) {
+            errno = static_cast<int>(-req.result);
+            perror(op == IORequest::READ ? "BufferPool: page read" : "BufferPool: page write");
+            return -1;
         }
+        return req.result;
+    }
 
-        const size_t n = fwrite(page.data, page.page_size, 1, file);
-        STACK_TRACE_EXPECT(1, n);
-        
-        return true;
+    auto disk_write(const Page page) -> bool { // Caller must hold the frame latch, bp lock not needed
+        return page_io(IORequest::WRITE, page.pid, page.data) >= 0;
     }
 
-    void increment_frame_accesses(const frame_id_t fid) { // Lock must be held.
-        auto it = frame_accesses.find(fid);
-        if (it == frame_accesses.end()) {
-            FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("All frames should have a play in the frame access map"); }
-        const unsigned int cur = it->second;
-        frame_accesses.insert_or_assign(fid, (cur + 1) % k);
+    // Evictor half of the pin handshake, called by the replacer under the shard lock. parked is raised before the CAS, so
+    //  either the CAS sees the last pin gone, or the thread that drops it sees parked and hands the frame back (unpin())
+    [[nodiscard]] auto try_claim(const frame_id_t frame) noexcept -> bool {
+        parked[frame].store(true);
+        uint32_t expected = 0;
+        if (pin_count[frame].compare_exchange_strong(expected, EVICTING)) {
+            parked[frame].store(false);
+            return true;
+        }
+        return false; // Replacer pins it on its side
     }
 
-    [[nodiscard]] auto evict(std::unique_lock<std::mutex>& bp_lock) -> bool {
-        STACK_TRACE_ASSERT(bp_lock.owns_lock());
+    void unpin(const frame_id_t frame) {
+        if (pin_count[frame].fetch_sub(1) != 1 || !parked[frame].load()) { return; }
 
-        // K, frame
-        std::priority_queue<std::pair<int, frame_id_t>, std::vector<std::pair<int, frame_id_t>>, std::greater<>> q; // Sorts ascending [1, 2, 3...]
+        // Last pin on a frame the replacer gave up on, make it evictable again
+        Shard& shard = shards[frame_shard[frame]];
+        std::lock_guard lock(shard.mu);
+        if (pin_count[frame].load() == 0 && parked[frame].load()) {
+            parked[frame].store(false);
+            shard.unpin(frame);
+        }
+    }
 
-        for (auto& p : frame_accesses) { // Loop over frames instead maybe?
-            const frame_id_t frame = p.first;
-            const int k = p.second;
-            if (frame_lock.is_locked(frame)) { continue; }
-            q.emplace(k, frame);
+    // Frees one frame of the shard. A dirty victim is written back first, with the shard lock dropped and a request on
+    //  its pid so nobody reads the stale copy off disk meanwhile, so callers must recheck everything once this returns ok.
+    // On a failed write back the page is put back as it was, still dirty
+    [[nodiscard]] auto evict(Shard& shard, std::unique_lock<std::mutex>& shard_lock, const bool background = false) -> PageGuardFailRC {
+        STACK_TRACE_ASSERT(shard_lock.owns_lock());
+
+        const std::optional<frame_id_t> victim = shard.evict([this](const frame_id_t frame) { return try_claim(frame); });
+        if (!victim.has_value()) { return bp_full; } // Every frame in the shard is pinned
+        const frame_id_t frame = victim.value();
+
+        // Remove BP state, frame stays claimed (EVICTING) until it's loaded again
+        const page_id_t cur_pid = frame_to_page[frame].load(std::memory_order_relaxed);
+        THREAD_PRINT("evicting pid (" + std::to_string(cur_pid) + ", frame (" + std::to_string(frame) + ")");
+        shard.page_table.erase(cur_pid);
+        frame_to_page[frame].store(INVALID_PID, std::memory_order_relaxed);
+
+        if (dirty[frame].exchange(false)) {
+            const uint32_t ticket = frame_lock.begin_io(frame, shard_lock);
+            shard.frame_requests.emplace(cur_pid, FrameRequest{frame, ticket});
+            shard_lock.unlock();
+            const bool written = disk_write(Page{frame_memory[frame], page_size, cur_pid}); // Claimed, nobody can touch it
+            shard_lock.lock();
+            shard.frame_requests.erase(cur_pid);
+
+            if (!written) { // Only copy of the page, keep it, still counted in dirty_count
+                dirty[frame].store(true);
+                frame_to_page[frame].store(cur_pid, std::memory_order_release);
+                shard.page_table.insert(cur_pid, frame);
+                pin_count[frame].fetch_sub(EVICTING);
+                shard.record_access(frame, cur_pid);
+                frame_lock.end_io(frame, ticket, true); // Waiters find it resident again
+                return disk_error;
+            }
+            dirty_count.fetch_sub(1, std::memory_order_relaxed);
+            frame_lock.end_io(frame, ticket, true);
+            if (background) {
+                background_writes.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                foreground_writes.fetch_add(1, std::memory_order_relaxed);
+                kick_flusher(); // It's falling behind
+            }
         }
-        
-        if (!q.empty()) {
-            const auto p = q.top();
-            const frame_id_t frame = p.second;
-            
-            // Remove BP state
-            free_frames.emplace(frame);
-            const page_id_t cur_pid = frame_to_page_map[frame];
-            THREAD_PRINT("evicting pid (" + std::to_string(cur_pid) + ", frame (" + std::to_string(frame) + ")");
-            page_to_frame_map.erase(cur_pid);
-            frame_to_page_map.erase(frame);
-            frame_accesses.insert_or_assign(frame, 0);
-            return true;
-        } else {
+
+        shard.free_frames.push_back(frame);
+        my_stats().evictions.add();
+        return ok;
+    }
+
+    void release_frame(const frame_id_t frame, const AccessType access_type) {
+        frame_lock.unlock_frame(frame, access_type);
+        unpin(frame); // Only evictable once the latch is gone
+    }
+
+    // Pins pid's frame without loading it. -1 if it isn't resident
+    [[nodiscard]] auto pin_resident(const page_id_t pid) -> frame_id_t {
+        Shard& shard = shard_of(pid);
+        if (const frame_id_t frame = try_pin_resident(shard, pid); frame != -1) { return frame; }
+        std::unique_lock shard_lock(shard.mu);
+        const frame_id_t frame = shard.page_table.find(pid);
+        if (frame != -1) { pin_count[frame].fetch_add(1); }
+        return frame;
+    }
+
+    // Caller holds a pin and at least the shared latch, so nobody can modify the page while it's on its way to disk
+    [[nodiscard]] auto write_back(const frame_id_t frame, const page_id_t pid) -> bool {
+        if (!dirty[frame].exchange(false)) { return true; }
+        if (!disk_write(Page{frame_memory[frame], page_size, pid})) {
+            dirty[frame].store(true); // Still counted in dirty_count
             return false;
         }
+        dirty_count.fetch_sub(1, std::memory_order_relaxed);
+        return true;
     }
 
-    void deallocate_page(const page_id_t pid, const AccessType access_type, std::unique_lock<std::mutex>& lock) {
-        STACK_TRACE_ASSERT(lock.owns_lock());
-        // std::cout << "Deallocating pid (" << pid << ", access type (" << (access_type == WRITE ? "WRITE" : "READ") << ")" << std::endl;
+    // Not under flusher_mu, a notify that races the flusher going to sleep costs at most one flusher_interval
+    void kick_flusher() {
+        if (!flusher.has_value() || flusher_kick.exchange(true, std::memory_order_relaxed)) { return; }
+        flusher_cv.notify_one();
+    }
 
-        auto frame_it = page_to_frame_map.find(pid);
-        if (frame_it == page_to_frame_map.end()) {
-            FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("Tried to deallocate page with no associated frame"); }
-        const frame_id_t frame = frame_it->second;
-        lock.unlock();
-        
-        frame_lock.unlock_frame(frame, access_type);
-        // std::cout << "Successfully deallocated pid (" << pid << ", access type (" << (access_type == WRITE ? "WRITE" : "READ") << ")" << std::endl;
+    void flusher_loop() {
+        std::unique_lock lock(flusher_mu);
+        while (!flusher_stop) {
+            flusher_cv.wait_for(lock, options.flusher_interval, [this]() { return flusher_stop || flusher_kick.load(std::memory_order_relaxed); });
+            if (flusher_stop) { break; }
+            const bool kicked = flusher_kick.exchange(false, std::memory_order_relaxed);
+            lock.unlock();
+            flush_cycle(kicked);
+            lock.lock();
+        }
     }
 
-    [[nodiscard]] auto disk_read(const page_id_t pid, const frame_id_t frame, std::unique_lock<std::mutex>& lock) -> bool { // Must be called with lock held
-        STACK_TRACE_ASSERT(lock.owns_lock());
+    // One round of the background flusher. Kicked means a foreground thread just paid for a write, so flush down to the
+    //  low watermark even if the high one wasn't crossed
+    void flush_cycle(const bool kicked) {
+        const size_t per_sec = options.flusher_max_writes_per_sec;
+        const size_t frames_in_use = capacity();
+        size_t budget = frames_in_use;
+        if (per_sec != 0) {
+            const auto now = std::chrono::steady_clock::now();
+            const double burst = std::max(1.0, static_cast<double>(per_sec) * std::chrono::duration<double>(options.flusher_interval).count());
+            flusher_tokens = std::min(burst, flusher_tokens + static_cast<double>(per_sec) * std::chrono::duration<double>(now - flusher_refilled).count());
+            flusher_refilled = now;
+            budget = static_cast<size_t>(flusher_tokens);
+        }
+        const auto spend = [&]() {
+            budget--;
+            if (per_sec != 0) { flusher_tokens -= 1.0; } // Fractions carry over to the next cycle
+        };
+
+        // Dirty watermark, round robin over the frames so every dirty page gets its turn
+        const size_t high = static_cast<size_t>(options.flusher_dirty_high * frames_in_use);
+        const size_t low  = static_cast<size_t>(options.flusher_dirty_low  * frames_in_use);
+        if (kicked || dirty_count.load(std::memory_order_relaxed) > high) {
+            for (size_t scanned = 0; scanned < frame_slots && budget > 0 && dirty_count.load(std::memory_order_relaxed) > low; scanned++) {
+                const frame_id_t frame = flusher_cursor;
+                flusher_cursor = (flusher_cursor + 1) % static_cast<frame_id_t>(frame_slots);
+                if (!dirty[frame].load(std::memory_order_relaxed) || pin_count[frame].load(std::memory_order_relaxed) != 0) { continue; }
+
+                const page_id_t pid = frame_to_page[frame].load(std::memory_order_acquire);
+                if (pid == INVALID_PID) { continue; }
+                const frame_id_t pinned = pin_resident(pid);
+                if (pinned == -1) { continue; }
+                if (frame_lock.try_read_lock_frame(pinned)) { // Never wait on a page someone is writing
+                    if (dirty[pinned].load(std::memory_order_relaxed) && write_back(pinned, pid)) {
+                        background_writes.fetch_add(1, std::memory_order_relaxed);
+                        spend();
+                    }
+                    release_frame(pinned, READ);
+                } else {
+                    unpin(pinned);
+                }
+            }
+        }
 
-        RAII_File file{fopen(file_path.c_str(), "rb+")};
-        if (file == nullptr) {
-            // File doesn't exist, create it
-            file.reassign(fopen(file_path.c_str(), "wb+"));
-            if (file == nullptr) {
-                perror("fopen");
-                return false;
+        // Free watermark, evicting ahead of the misses. A dirty victim is written here instead of by a miss
+        if (options.flusher_free_target <= 0.0) { return; }
+        for (Shard& shard : shards) {
+            std::unique_lock shard_lock(shard.mu);
+            const size_t target = static_cast<size_t>(options.flusher_free_target * shard.frame_count);
+            while (budget > 0 && shard.free_frames.size() < target) {
+                const uint64_t written_before = background_writes.load(std::memory_order_relaxed);
+                if (evict(shard, shard_lock, true) != ok) { break; }
+                if (background_writes.load(std::memory_order_relaxed) != written_before) { spend(); }
             }
         }
+    }
 
-        // Move to offset
-        const int file_offset = pid * page_size;
-        if (fseek(file, file_offset, SEEK_SET) != 0) {
-            perror("fseek failed");
-            return false;
+    [[nodiscard]] auto disk_read(const page_id_t pid, const frame_id_t frame) -> bool { // Caller must hold the frame's I/O latch, bp lock not needed
+        char* bp_memory_location = frame_memory[frame];
+        const ssize_t bytes_read = page_io(IORequest::READ, pid, bp_memory_location);
+        if (bytes_read < 0) { return false; }
+        // Past EOF, page was never written. Fresh pages read as zeroes instead of whatever the last frame owner left behind
+        std::memset(bp_memory_location + bytes_read, 0, page_size - static_cast<size_t>(bytes_read));
+        return true;
+    }
+
+    // Frames are pinned and read latched by the caller, their dirty bits already taken. All go to the backend as one batch.
+    //  Releases them
+    struct DirtyPage {
+        page_id_t pid;
+        frame_id_t frame;
+    };
+    using DirtyPageAllocator = typename Traits::template rebind_alloc<DirtyPage>;
+
+    struct PendingLoad {
+        page_id_t pid;
+        frame_id_t frame;
+        uint32_t ticket;
+    };
+    using PendingLoadAllocator = typename Traits::template rebind_alloc<PendingLoad>;
+
+    // Takes a free (or evicted) frame for pid and registers the load, like a miss does, unless pid is resident or already on
+    //  its way in. nullopt then, or if the shard has nothing it can evict
+    [[nodiscard]] auto claim_for_load(const page_id_t pid) -> std::optional<PendingLoad> {
+        Shard& shard = shard_of(pid);
+        std::unique_lock shard_lock(shard.mu);
+        while (true) {
+            if (shard.page_table.find(pid) != -1 || shard.frame_requests.contains(pid)) { return std::nullopt; }
+            if (!shard.free_frames.empty()) { break; }
+            if (evict(shard, shard_lock) != ok) { return std::nullopt; } // Might have dropped the lock, look again
         }
 
-        const int bp_memory_offset = frame * page_size;
-        char* bp_memory_location = memory + bp_memory_offset;
-        
-        const size_t bytes_read = fread(bp_memory_location, 1, page_size, file);
-        // std::cout << "Read " << bytes_read << " bytes: " << std::string(bp_memory_location, bytes_read) << "\n";
-        if (ferror(file) != 0) {
-            perror("fread");
-            return false;
+        const frame_id_t frame = shard.free_frames.back(); // Claimed (EVICTING), readers can't pin it
+        shard.free_frames.pop_back();
+        const uint32_t ticket = frame_lock.begin_io(frame, shard_lock);
+        shard.frame_requests.emplace(pid, FrameRequest{frame, ticket});
+        return PendingLoad{pid, frame, ticket};
+    }
+
+    // Reads claimed frames as one batch and publishes them unpinned, evictable like any other resident page. Guards that
+    //  found a load's request waiting on its ticket then hit. A failed read hands its frame back to the free list.
+    // Runs of consecutive pids are coalesced into one readv scattering into their (not contiguous) frames
+    void load_batch(const std::span<PendingLoad> loads, const bool prefetch) {
+        std::sort(loads.begin(), loads.end(), [](const PendingLoad& a, const PendingLoad& b) { return a.pid < b.pid; });
+        std::vector<iovec, IovecAllocator> iovs(loads.size(), iovec{}, IovecAllocator(allocator_));
+        std::vector<IORequest, IORequestAllocator> requests{IORequestAllocator(allocator_)};
+        std::vector<size_t, SizeAllocator> request_of(loads.size(), 0, SizeAllocator(allocator_)); // Load -> its request
+        for (size_t i = 0; i < loads.size(); i++) {
+            iovs[i] = iovec{frame_memory[loads[i].frame], page_size};
+            if (i > 0 && loads[i].pid == loads[i - 1].pid + 1) {
+                requests.back().iovcnt++;
+            } else {
+                requests.push_back(IORequest{IORequest::READ, fd.get(), static_cast<off_t>(loads[i].pid) * static_cast<off_t>(page_size), &iovs[i], 1});
+            }
+            request_of[i] = requests.size() - 1;
+        }
+        read_ops.fetch_add(loads.size(), std::memory_order_relaxed);
+        const auto start = std::chrono::steady_clock::now();
+        read_syscalls.fetch_add(io->submit_and_wait(requests), std::memory_order_relaxed);
+        ThreadStats& stats = my_stats();
+        stats.disk_read_latency.record(std::chrono::steady_clock::now() - start);
+        stats.page_reads.add(loads.size());
+
+        size_t run_start = 0;
+        for (size_t i = 0; i < loads.size(); i++) {
+            const auto [pid, frame, ticket] = loads[i];
+            if (i == 0 || request_of[i] != request_of[i - 1]) { run_start = i; }
+            // Only a read that ran into EOF comes back short, whatever it didn't reach of this page is past the end
+            const ssize_t run_bytes = requests[request_of[i]].result;
+            const ssize_t page_offset = static_cast<ssize_t>((i - run_start) * page_size);
+            const ssize_t bytes_read = run_bytes < 0 ? run_bytes : std::clamp<ssize_t>(run_bytes - page_offset, 0, static_cast<ssize_t>(page_size));
+            char* const data = frame_memory[frame];
+            if (bytes_read >= 0) { std::memset(data + bytes_read, 0, page_size - static_cast<size_t>(bytes_read)); } // Past EOF
+
+            Shard& shard = shard_of(pid);
+            std::unique_lock shard_lock(shard.mu);
+            shard.frame_requests.erase(pid);
+            if (bytes_read < 0) {
+                errno = static_cast<int>(-bytes_read);
+                perror("BufferPool: page read");
+                shard.free_frames.push_back(frame); // Never published, still claimed
+                frame_lock.end_io(frame, ticket, false);
+                continue;
+            }
+            origin[frame].store(PREFETCHED, std::memory_order_relaxed);
+            frame_to_page[frame].store(pid, std::memory_order_release);
+            shard.page_table.insert(pid, frame);
+            pin_count[frame].fetch_sub(EVICTING); // Unpinned, any reader's transient pin stays intact
+            shard.record_access(frame, pid);
+            frame_lock.end_io(frame, ticket, true);
+            if (prefetch) { prefetch_reads.fetch_add(1, std::memory_order_relaxed); }
+            sanity_check(shard, shard_lock);
         }
+    }
 
-        return true;
+    // prefetch: counted in prefetch_reads, otherwise the caller pins the pages right after (multi page guards)
+    void load_unpinned(const std::span<const page_id_t> pids, const bool prefetch = true) {
+        const size_t batch_size = std::max<size_t>(options.io_queue_depth, 1);
+        std::vector<PendingLoad, PendingLoadAllocator> loads{PendingLoadAllocator(allocator_)};
+        loads.reserve(batch_size);
+        for (const page_id_t pid : pids) {
+            if (const std::optional<PendingLoad> load = claim_for_load(pid); load.has_value()) { loads.push_back(load.value()); }
+            if (loads.size() == batch_size) {
+                load_batch(loads, prefetch);
+                loads.clear();
+            }
+        }
+        if (!loads.empty()) { load_batch(loads, prefetch); }
     }
 
-    // So all pages map to the same frame, so different threads don't alloc the same pid to a thousand different frames
-    using frame_requests_set_Allocator  = typename Traits::template rebind_alloc<page_id_t>;
-    std::unordered_set<page_id_t, std::hash<page_id_t>, std::equal_to<page_id_t>, frame_requests_set_Allocator> frame_requests;
+    // Runs of consecutive pids (pids come sorted) are coalesced into one pwritev gathering from their frames
+    [[nodiscard]] auto write_back_batch(const std::span<const frame_id_t> frames, const std::span<const page_id_t> pids) -> bool {
+        std::vector<iovec, IovecAllocator> iovs(frames.size(), iovec{}, IovecAllocator(allocator_));
+        std::vector<IORequest, IORequestAllocator> requests{IORequestAllocator(allocator_)};
+        std::vector<size_t, SizeAllocator> request_of(frames.size(), 0, SizeAllocator(allocator_)); // Page -> its request
+        for (size_t i = 0; i < frames.size(); i++) {
+            iovs[i] = iovec{frame_memory[frames[i]], page_size};
+            if (i > 0 && pids[i] == pids[i - 1] + 1) {
+                requests.back().iovcnt++;
+            } else {
+                requests.push_back(IORequest{IORequest::WRITE, fd.get(), static_cast<off_t>(pids[i]) * static_cast<off_t>(page_size), &iovs[i], 1});
+            }
+            request_of[i] = requests.size() - 1;
+        }
+        write_ops.fetch_add(frames.size(), std::memory_order_relaxed);
+        const auto start = std::chrono::steady_clock::now();
+        write_syscalls.fetch_add(io->submit_and_wait(requests), std::memory_order_relaxed);
+        ThreadStats& stats = my_stats();
+        stats.disk_write_latency.record(std::chrono::steady_clock::now() - start);
+        stats.write_backs.add(frames.size());
+
+        bool all_written = true;
+        for (size_t i = 0; i < frames.size(); i++) {
+            const IORequest& request = requests[request_of[i]];
+            if (request.result < 0) { // A failed write is all or nothing for its run
+                errno = static_cast<int>(-request.result);
+                perror("BufferPool: page write");
+                dirty[frames[i]].store(true); // Still counted in dirty_count
+                all_written = false;
+            } else {
+                dirty_count.fetch_sub(1, std::memory_order_relaxed);
+            }
+            release_frame(frames[i], READ);
+        }
+        return all_written;
+    }
 
-    [[nodiscard]] auto get_frame(const page_id_t pid, AccessType access_type, std::unique_lock<std::mutex>& bp_lock) -> std::pair<frame_id_t, PageGuardFailRC> {
-        STACK_TRACE_ASSERT(bp_lock.owns_lock());
+    // Every thread's counters added up, plus what the pool holds right now. Takes stats_mu and goes over each thread's block
+    //  and each frame's pin count, so it's for monitoring, not for the hot path
+    [[nodiscard]] auto stats() const -> BufferPoolStats {
+        BufferPoolStats total{};
+        {
+            std::lock_guard lock(stats_mu);
+            for (const ThreadStats& stats : thread_stats_blocks) { add_stats(total, stats); }
+        }
+        for (size_t frame = 0; frame < frame_slots; frame++) {
+            const uint32_t pins = pin_count[frame].load(std::memory_order_relaxed);
+            if (pins != 0 && (pins & EVICTING) == 0) { total.pinned_frames++; }
+        }
+        total.dirty_frames = dirty_count.load(std::memory_order_relaxed);
+        return total;
+    }
 
-        START:
+    // What the calling thread did in this pool
+    [[nodiscard]] auto thread_stats() -> BufferPoolStats {
+        BufferPoolStats mine{};
+        add_stats(mine, my_stats());
+        return mine;
+    }
+
+    [[nodiscard]] auto invariant_check_stats() const noexcept -> InvariantCheckStats {
+        return InvariantCheckStats{invariant_checks.load(std::memory_order_relaxed), invariant_check_frames.load(std::memory_order_relaxed)};
+    }
+
+    [[nodiscard]] auto io_stats() const noexcept -> IOStats {
+        return IOStats{
+            read_ops.load(std::memory_order_relaxed),
+            read_syscalls.load(std::memory_order_relaxed),
+            write_ops.load(std::memory_order_relaxed),
+            write_syscalls.load(std::memory_order_relaxed),
+            foreground_writes.load(std::memory_order_relaxed),
+            background_writes.load(std::memory_order_relaxed),
+            prefetch_reads.load(std::memory_order_relaxed),
+        };
+    }
+
+    // Whether a guard on frame (pinned by the caller) is an access the replacer should hear about. A bulk read never is, and
+    //  leaves the frame's origin alone. Anything else turns the page into a normal one, the first use of a prefetched page
+    //  doesn't count (its load did)
+    [[nodiscard]] auto counts_as_access(const frame_id_t frame, const AccessHint hint) noexcept -> bool {
+        if (hint == AccessHint::BULK_READ) { return false; }
+        if (origin[frame].load(std::memory_order_relaxed) == DEMAND) { return true; }
+        return origin[frame].exchange(DEMAND, std::memory_order_relaxed) != PREFETCHED;
+    }
+
+    // BULK_READ miss. Once the shard's ring is full, the frame of its oldest page is taken for the next one, unless something
+    //  else has used that page since. Returns the frame claimed and emptied, or -1 and the caller gets one the usual way,
+    //  adding to the ring. Ring pages are never dirty, a write guard turns them into normal pages first.
+    // The replacer never sees ring pages, this is the only way their frames come back. A ring page still pinned goes to the
+    //  back of the ring, so the ring can run over its capacity for as long as a scan holds on to its pages
+    [[nodiscard]] auto recycle_bulk_frame(Shard& shard) -> frame_id_t {
+        for (size_t tries = shard.bulk_ring.size(); tries > 0 && shard.bulk_ring.size() >= bulk_ring_capacity; tries--) {
+            const auto [frame, pid] = shard.bulk_ring.front();
+            shard.bulk_ring.pop_front();
+            // Left the ring since (used normally, the replacer has it now)
+            if (frame_to_page[frame].load(std::memory_order_relaxed) != pid || origin[frame].load() != BULK) { continue; }
+            uint32_t expected = 0;
+            if (!pin_count[frame].compare_exchange_strong(expected, EVICTING)) {
+                shard.bulk_ring.emplace_back(frame, pid);
+                continue;
+            }
+            if (origin[frame].load() != BULK || dirty[frame].load()) { // Used normally right before the claim, keep it
+                pin_count[frame].fetch_sub(EVICTING);
+                continue;
+            }
+            shard.page_table.erase(pid);
+            frame_to_page[frame].store(INVALID_PID, std::memory_order_relaxed);
+            my_stats().evictions.add();
+            return frame;
+        }
+        return -1;
+    }
+
+    // Hit path, no shard lock. Pins the frame pid's page table entry points at and checks it still holds pid. -1 on a miss,
+    //  or if the frame is mid eviction / load, the caller then takes the locked path which is authoritative
+    [[nodiscard]] auto try_pin_resident(const Shard& shard, const page_id_t pid) -> frame_id_t {
+        const frame_id_t frame = shard.page_table.find(pid);
+        if (frame == -1) { return -1; }
+        if ((pin_count[frame].fetch_add(1) & EVICTING) != 0) {
+            pin_count[frame].fetch_sub(1); // Claimed, it's the claimer's now
+            return -1;
+        }
+        if (frame_to_page[frame].load(std::memory_order_acquire) != pid) { // Entry was stale, frame holds another page
+            unpin(frame);
+            return -1;
+        }
+        return frame;
+    }
 
-        auto frame_it = page_to_frame_map.find(pid);
-        // In memory
-        if (frame_it != page_to_frame_map.end()) {
-            const frame_id_t frame = frame_it->second;
-            frame_lock.lock_frame(frame, access_type, bp_lock);
+    // page_in_use if the latch isn't free by deadline, the frame is unpinned again
+    [[nodiscard]] auto get_frame(const page_id_t pid, AccessType access_type, const AccessHint hint = AccessHint::NORMAL, const Deadline deadline = NO_DEADLINE)
+        -> std::pair<frame_id_t, PageGuardFailRC> {
+        Shard& shard = shard_of(pid);
+        ThreadStats& stats = my_stats();
+        const bool timed = hit_sample_due(stats); // The clock has to be read before it's known to be a hit
+        const auto start = timed ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+
+        // In memory, lock free
+        if (const frame_id_t frame = try_pin_resident(shard, pid); frame != -1) {
+            note_access(pid, false); // Before the latch, read-ahead can mean disk I/O on this thread
+            if (!frame_lock.lock_frame_until(frame, access_type, deadline)) {
+                unpin(frame);
+                return {{}, page_in_use};
+            }
+            const bool from_ring = hint != AccessHint::BULK_READ && origin[frame].load(std::memory_order_relaxed) == BULK;
+            if (counts_as_access(frame, hint)) {
+                if (from_ring) { // The replacer doesn't have it yet, and the ring lets go of it. Don't leave that to the batch
+                    std::lock_guard lock(shard.mu);
+                    shard.record_access(frame, pid);
+                } else {
+                    defer_access(frame, pid);
+                }
+            }
+            stats.hits.add();
+            if (sample_hit(stats) && timed) { stats.hit_latency.record(std::chrono::steady_clock::now() - start); }
+            return {frame, ok};
+        }
+
+        flush_access_batch();
+        note_access(pid, true); // Might load pid along with the pages after it
+        const auto slow_start = timed ? start : std::chrono::steady_clock::now();
+        std::unique_lock shard_lock(shard.mu);
 
-            STACK_TRACE_ASSERT(page_to_frame_map.find(pid)!= page_to_frame_map.end());
+        START:
+
+        // In memory. Nothing can claim a frame that's in the page table while we hold the shard lock
+        if (const frame_id_t frame = shard.page_table.find(pid); frame != -1) {
+            const uint32_t prev_pins = pin_count[frame].fetch_add(1);
+            STACK_TRACE_ASSERT((prev_pins & EVICTING) == 0);
+            if (counts_as_access(frame, hint)) { shard.record_access(frame, pid); }
+            sanity_check(shard, shard_lock);
+            shard_lock.unlock();
+            if (!frame_lock.lock_frame_until(frame, access_type, deadline)) {
+                unpin(frame);
+                return {{}, page_in_use};
+            }
+            stats.hits.add();
+            if (sample_hit(stats) && timed) { stats.hit_latency.record(std::chrono::steady_clock::now() - start); }
             return {frame, ok};
         }
         
         // Not in memory, make request
 
-        // Someone already made the request
-        if (frame_requests.contains(pid) ) {
-
-            bp_lock.unlock();
-            uint32_t backoff = 512;
-            constexpr uint32_t max_backoff = 1'000'000; // 1ms worst-case
-            while (true) {
-                bp_lock.lock();
-                if (!frame_requests.contains(pid)) { break; }
-                bp_lock.unlock();
-                // std::this_thread::yield();
-                backoff *= 2;
-                backoff = std::min(backoff * 2, max_backoff);
-            }
-            STACK_TRACE_ASSERT(bp_lock.owns_lock());
+        // Someone already made the request, sleep until that load completes instead of polling the pool
+        if (auto req_it = shard.frame_requests.find(pid); req_it != shard.frame_requests.end()) {
+            const FrameRequest req = req_it->second;
+            shard_lock.unlock();
+            const auto wait_start = std::chrono::steady_clock::now();
+            const bool loaded = frame_lock.wait_io(req.frame, req.ticket);
+            stats.request_waits.add();
+            stats.request_wait_ns.add(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - wait_start).count()));
+            shard_lock.lock();
+            if (!loaded) { return {{}, disk_error}; } // Don't retry the read the loader just failed
             goto START;
         } else { // Make the request
             
-            if (free_frames.empty()) { // Evict if full
-                const bool ok = evict(bp_lock);
-                if (!ok) { return {{}, bp_full}; }
+            frame_id_t frame = hint == AccessHint::BULK_READ ? recycle_bulk_frame(shard) : -1;
+            if (frame == -1) {
+                if (shard.free_frames.empty()) { // Evict if full
+                    const PageGuardFailRC evict_rc = evict(shard, shard_lock);
+                    if (evict_rc != ok) { return {{}, evict_rc}; }
+                    goto START; // Might have dropped the lock for a write back, someone else may have loaded pid or taken the frame
+                }
+                frame = shard.free_frames.back(); // Claimed (EVICTING), readers can't pin it
+                shard.free_frames.pop_back();
             }
-            STACK_TRACE_ASSERT(!free_frames.empty());
-            
-            const frame_id_t frame = *free_frames.begin();
-            free_frames.erase(frame);
-
-            // Lock
-            frame_requests.emplace(pid);
-            frame_lock.lock_frame(frame, access_type, bp_lock); // Only time bp_lock unlocks
-            STACK_TRACE_ASSERT(bp_lock.owns_lock());
-
-            // Disk read
-            const bool ok = disk_read(pid, frame, bp_lock);
-            if (!ok) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("DISK READ FAILED"); frame_requests.erase(pid); return {{}, disk_error}; }
-            // Add state to BP
-            page_to_frame_map.emplace(pid, frame);
-            frame_to_page_map.emplace(frame, pid);
-            frame_requests.erase(pid);
+
+            const uint32_t ticket = frame_lock.begin_io(frame, shard_lock);
+            shard.frame_requests.emplace(pid, FrameRequest{frame, ticket});
+
+            // Disk read, the request and the claim keep everyone else off this frame, so the latch never blocks here
+            shard_lock.unlock();
+            frame_lock.lock_frame(frame, access_type);
+            const bool ok = disk_read(pid, frame);
+            shard_lock.lock();
+
+            if (!ok) {
+                shard.frame_requests.erase(pid);
+                frame_lock.unlock_frame(frame, access_type);
+                shard.free_frames.push_back(frame); // Never published, still claimed
+                frame_lock.end_io(frame, ticket, false);
+                return {{}, disk_error};
+            }
+            // Add state to BP, then turn the claim into our pin. fetch_sub keeps any reader's transient pin intact
+            origin[frame].store(hint == AccessHint::BULK_READ ? BULK : DEMAND, std::memory_order_relaxed);
+            if (hint == AccessHint::BULK_READ) { shard.bulk_ring.emplace_back(frame, pid); }
+            frame_to_page[frame].store(pid, std::memory_order_release);
+            shard.page_table.insert(pid, frame);
+            pin_count[frame].fetch_sub(EVICTING - 1);
+            if (hint != AccessHint::BULK_READ) { shard.record_access(frame, pid); } // Ring pages stay out of the replacer
+            shard.frame_requests.erase(pid);
+            frame_lock.end_io(frame, ticket, true);
+            sanity_check(shard, shard_lock);
+            stats.misses.add();
+            stats.miss_latency.record(std::chrono::steady_clock::now() - slow_start);
 
             return {frame, PageGuardFailRC::ok};
         }
     }
 
-    void write_unlock(Page page) noexcept { // Always assumes dirty
-        std::unique_lock<std::mutex> lock(mu);
-        disk_write(page, lock);
-        deallocate_page(page.pid, WRITE, lock);
+    // get_frame() for several pages at once: frames[i] gets pids[i], latched for writing if i < write_count, for reading
+    //  otherwise. page_in_use if the latches couldn't all be had by deadline. All or nothing, on failure nothing is left
+    //  pinned or latched
+    [[nodiscard]] auto get_frames(const std::span<const page_id_t> pids, const size_t write_count, const std::span<frame_id_t> frames, const Deadline deadline)
+        -> PageGuardFailRC {
+        STACK_TRACE_ASSERT(frames.size() == pids.size() && write_count <= pids.size());
+        if (pids.empty()) { return ok; }
+        std::vector<size_t, SizeAllocator> order(pids.size(), 0, SizeAllocator(allocator_));
+        std::iota(order.begin(), order.end(), size_t{0});
+        std::sort(order.begin(), order.end(), [&](const size_t a, const size_t b) { return pids[a] < pids[b]; });
+        for (size_t k = 1; k < order.size(); k++) {
+            if (pids[order[k]] == pids[order[k - 1]]) { // Would wait on itself
+                FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("BufferPool::get_frames(): pid (" + std::to_string(pids[order[k]]) + ") asked for twice");
+            }
+        }
+
+        if (const PageGuardFailRC rc = pin_frames(pids, frames); rc != ok) { return rc; }
+        if (!latch_frames(order, write_count, frames, deadline)) {
+            for (const frame_id_t frame : frames) { unpin(frame); }
+            return page_in_use;
+        }
+        return ok;
+    }
+
+    // Pins every page into frames without latching. Resident pages are pinned under one shard lock per shard, the others
+    //  are read in one coalesced batch and then pinned the same way. A page the batch couldn't get a frame for, or that got
+    //  evicted again before its pin, goes through get_frame()
+    [[nodiscard]] auto pin_frames(const std::span<const page_id_t> pids, const std::span<frame_id_t> frames) -> PageGuardFailRC {
+        flush_access_batch();
+        std::vector<size_t, SizeAllocator> todo(pids.size(), 0, SizeAllocator(allocator_)); // Indices of pids not pinned yet
+        std::iota(todo.begin(), todo.end(), size_t{0});
+        std::sort(todo.begin(), todo.end(), [&](const size_t a, const size_t b) { return shard_index_of(pids[a]) < shard_index_of(pids[b]); });
+
+        // Pins the resident pages of todo and leaves the others in it, still sorted by shard
+        const auto pin_resident = [&](const bool just_loaded) {
+            size_t kept = 0;
+            for (size_t k = 0; k < todo.size();) {
+                Shard& shard = shard_of(pids[todo[k]]);
+                std::unique_lock shard_lock(shard.mu);
+                for (; k < todo.size() && &shard_of(pids[todo[k]]) == &shard; k++) {
+                    const size_t i = todo[k];
+                    frames[i] = shard.page_table.find(pids[i]);
+                    if (frames[i] == -1) {
+                        todo[kept++] = i;
+                        continue;
+                    }
+                    const uint32_t prev_pins = pin_count[frames[i]].fetch_add(1);
+                    STACK_TRACE_ASSERT((prev_pins & EVICTING) == 0);
+                    if (counts_as_access(frames[i], AccessHint::NORMAL)) { shard.record_access(frames[i], pids[i]); }
+                    if (just_loaded) {
+                        my_stats().misses.add();
+                    } else {
+                        my_stats().hits.add();
+                    }
+                }
+            }
+            todo.resize(kept);
+        };
+
+        pin_resident(false);
+        if (todo.empty()) { return ok; }
+
+        std::vector<page_id_t, PageIDAllocator> missing{PageIDAllocator(allocator_)};
+        missing.reserve(todo.size());
+        for (const size_t i : todo) { missing.push_back(pids[i]); }
+        load_unpinned(missing, false);
+        pin_resident(true);
+
+        for (const size_t i : todo) {
+            const auto [frame, rc] = get_frame(pids[i], PIN);
+            if (rc != ok) {
+                for (const frame_id_t pinned : frames) {
+                    if (pinned != -1) { unpin(pinned); }
+                }
+                return rc;
+            }
+            frames[i] = frame;
+        }
+        return ok;
+    }
+
+    // Latches pinned frames in pid order (order). Only ever blocks while holding none of them: a latch that's taken drops
+    //  the ones held, waits for that one alone (until deadline) and starts over from it. At worst goes round a few times
+    //  while single guards come and go. It can't see latches the caller already holds though, waiting on a page whose holder
+    //  waits on one of those deadlocks unless there's a deadline. False on the deadline, with nothing latched
+    [[nodiscard]] auto latch_frames(const std::span<const size_t> order, const size_t write_count, const std::span<const frame_id_t> frames, const Deadline deadline)
+        -> bool {
+        const auto type_of = [write_count](const size_t i) { return i < write_count ? WRITE : READ; };
+        size_t first = order[0]; // The one waited for
+        while (true) {
+            if (!frame_lock.lock_frame_until(frames[first], type_of(first), deadline)) { return false; }
+            size_t taken = 0; // Of order, besides first
+            bool all = true;
+            for (; taken < order.size(); taken++) {
+                const size_t i = order[taken];
+                if (i == first) { continue; }
+                if (!frame_lock.lock_frame_until(frames[i], type_of(i), NO_WAIT)) {
+                    all = false;
+                    break;
+                }
+            }
+            if (all) { return true; }
+            const size_t contended = order[taken];
+            for (size_t k = 0; k < taken; k++) {
+                if (order[k] != first) { frame_lock.unlock_frame(frames[order[k]], type_of(order[k])); }
+            }
+            frame_lock.unlock_frame(frames[first], type_of(first));
+            first = contended;
+        }
+    }
+
+    // Written back on eviction or flush, not here. Published by the unpin
+    void mark_dirty(const frame_id_t frame) noexcept {
+        if (!dirty[frame].exchange(true, std::memory_order_relaxed)) {
+            const size_t now_dirty = dirty_count.fetch_add(1, std::memory_order_relaxed) + 1;
+            if (now_dirty > options.flusher_dirty_high * capacity()) { kick_flusher(); }
+        }
+    }
+
+    void write_unlock(const frame_id_t frame, const bool modified) noexcept {
+        if (modified) { mark_dirty(frame); }
+        release_frame(frame, WRITE);
+    }
+
+    void read_unlock(const frame_id_t frame) noexcept {
+        release_frame(frame, READ);
+    }
+
+    // What guards call to give their frame back, see PageGuard.h
+    static void release_write_guard(void* const pool, const frame_id_t frame, const bool modified) noexcept {
+        static_cast<BufferPool*>(pool)->write_unlock(frame, modified);
+    }
+
+    static void release_read_guard(void* const pool, const frame_id_t frame) noexcept {
+        static_cast<BufferPool*>(pool)->read_unlock(frame);
+    }
+
+    // The pin stays with the frame across both, only the latch changes
+    static auto upgrade_guard(void* const pool, const frame_id_t frame) noexcept -> bool {
+        return static_cast<BufferPool*>(pool)->frame_lock.try_upgrade_frame(frame);
+    }
+
+    static void downgrade_guard(void* const pool, const frame_id_t frame, const bool modified) noexcept {
+        BufferPool& bp = *static_cast<BufferPool*>(pool);
+        if (modified) { bp.mark_dirty(frame); }
+        bp.frame_lock.downgrade_frame(frame);
+    }
+
+    // PinnedPage's side, see PageGuard.h. The handle's pin keeps the frame resident, so a guard's pin is a plain fetch_add
+    static void unpin_pinned_page(void* const pool, const frame_id_t frame) noexcept {
+        static_cast<BufferPool*>(pool)->unpin(frame);
+    }
+
+    [[nodiscard]] static auto pinned_read_guard(void* const pool, const frame_id_t frame, const page_id_t pid) -> ReadPageGuard {
+        BufferPool& bp = *static_cast<BufferPool*>(pool);
+        bp.pin_count[frame].fetch_add(1);
+        bp.frame_lock.read_lock_frame(frame);
+        return ReadPageGuard{pool, &page_guard_ops, frame, Page{bp.frame_memory[frame], bp.page_size, pid}};
+    }
+
+    [[nodiscard]] static auto pinned_write_guard(void* const pool, const frame_id_t frame, const page_id_t pid) -> WritePageGuard {
+        BufferPool& bp = *static_cast<BufferPool*>(pool);
+        bp.pin_count[frame].fetch_add(1);
+        bp.frame_lock.write_lock_frame(frame);
+        return WritePageGuard{pool, &page_guard_ops, frame, Page{bp.frame_memory[frame], bp.page_size, pid}};
+    }
+
+    [[nodiscard]] static auto pinned_optimistic_read_guard(void* const pool, const frame_id_t frame, const page_id_t pid) -> OptimisticReadGuard {
+        const BufferPool& bp = *static_cast<BufferPool*>(pool);
+        return OptimisticReadGuard{&bp.frame_lock.latch(frame), Page{bp.frame_memory[frame], bp.page_size, pid}};
+    }
+
+    static constexpr PageGuardOps page_guard_ops{&release_read_guard, &release_write_guard, &upgrade_guard, &downgrade_guard,
+                                                 &unpin_pinned_page, &pinned_read_guard, &pinned_write_guard, &pinned_optimistic_read_guard};
+
+
+    // Writes pid back if it's resident and dirty. Waits for writers on the page, must not be called while holding its write guard
+    [[nodiscard]] auto flush_page(const page_id_t pid) -> bool {
+        const frame_id_t frame = pin_resident(pid);
+        if (frame == -1) { return true; } // Not resident (or being written back by eviction), nothing to do
+        frame_lock.read_lock_frame(frame);
+        const bool written = write_back(frame, pid);
+        release_frame(frame, READ);
+        return written;
+    }
+
+    // Writes back one slice of checkpoint()'s sorted pages, at most io_queue_depth runs and max_pages pages per batch. A page
+    //  with a write guard out is skipped at first (waiting on it while holding the batch's latches could deadlock) and waited
+    //  for on its own at the end
+    [[nodiscard]] auto write_back_region(const std::span<const DirtyPage> pages, const size_t max_pages) -> bool {
+        const size_t max_runs = std::max<size_t>(options.io_queue_depth, 1);
+        std::vector<frame_id_t, FrameIDAllocator> frames{FrameIDAllocator(allocator_)};
+        std::vector<page_id_t, PageIDAllocator> pids{PageIDAllocator(allocator_)};
+        std::vector<page_id_t, PageIDAllocator> busy{PageIDAllocator(allocator_)};
+        frames.reserve(max_pages);
+        pids.reserve(max_pages);
+
+        bool all_written = true;
+        size_t runs = 0;
+        for (const auto [pid, frame] : pages) {
+            const frame_id_t pinned = pin_resident(pid);
+            if (pinned == -1) { continue; } // Evicted since, the evictor wrote it
+            if (!frame_lock.try_read_lock_frame(pinned)) {
+                unpin(pinned);
+                busy.push_back(pid);
+                continue;
+            }
+            if (!dirty[pinned].exchange(false)) {
+                release_frame(pinned, READ);
+                continue;
+            }
+            const bool extends_run = !pids.empty() && pid == pids.back() + 1;
+            if (frames.size() == max_pages || (runs == max_runs && !extends_run)) {
+                all_written &= write_back_batch(frames, pids);
+                frames.clear();
+                pids.clear();
+                runs = 0;
+            }
+            if (pids.empty() || pid != pids.back() + 1) { runs++; }
+            frames.push_back(pinned);
+            pids.push_back(pid);
+        }
+        if (!frames.empty()) { all_written &= write_back_batch(frames, pids); }
+
+        for (const page_id_t pid : busy) { all_written &= flush_page(pid); }
+        return all_written;
+    }
+
+    // Writes back every dirty resident page, fdatasync()ing the file at the end if sync. False if any write (or the sync)
+    //  failed, those pages stay dirty.
+    // Dirty pages are sorted by pid so runs of adjacent pages go out as single pwritevs, io_queue_depth runs per batch to the
+    //  I/O backend. With checkpoint_threads > 1 the sorted pages are cut into that many file regions, written in parallel by
+    //  the caller and checkpoint_writers.
+    //  Pages are only pinned a batch at a time (never more than a quarter of the pool in all), so the pool keeps working meanwhile
+    [[nodiscard]] auto checkpoint(const bool sync = true) -> bool {
+        std::vector<DirtyPage, DirtyPageAllocator> pages{DirtyPageAllocator(allocator_)};
+        pages.reserve(dirty_count.load(std::memory_order_relaxed));
+        for (size_t frame = 0; frame < frame_slots; frame++) {
+            if (!dirty[frame].load(std::memory_order_relaxed)) { continue; }
+            const page_id_t pid = frame_to_page[frame].load(std::memory_order_acquire);
+            if (pid == INVALID_PID) { continue; } // Mid eviction, the evictor writes it
+            pages.push_back(DirtyPage{pid, static_cast<frame_id_t>(frame)});
+        }
+        std::sort(pages.begin(), pages.end(), [](const DirtyPage& a, const DirtyPage& b) { return a.pid < b.pid; });
+
+        const size_t regions = std::clamp<size_t>(options.checkpoint_threads, 1, std::max<size_t>(pages.size(), 1));
+        const size_t max_pages = std::clamp<size_t>(capacity() / (4 * regions), 1, IOV_MAX);
+        const auto region = [&](const size_t i) {
+            const size_t begin = pages.size() * i / regions;
+            const size_t end = pages.size() * (i + 1) / regions;
+            return std::span<const DirtyPage>(pages).subspan(begin, end - begin);
+        };
+
+        bool all_written = true;
+        if (regions == 1) {
+            all_written = write_back_region(region(0), max_pages);
+        } else {
+            std::atomic<bool> regions_written{true};
+            IOBatch done(regions - 1);
+            for (size_t i = 1; i < regions; i++) {
+                checkpoint_writers->give_work([&, i]() {
+                    if (!write_back_region(region(i), max_pages)) { regions_written.store(false); }
+                    done.complete_one();
+                });
+            }
+            all_written = write_back_region(region(0), max_pages); // The caller takes the first region itself
+            done.wait();
+            all_written &= regions_written.load();
+        }
+
+        if (sync && fdatasync(fd.get()) != 0) {
+            perror("BufferPool: fdatasync");
+            all_written = false;
+        }
+        if (options.warm_restart) { [[maybe_unused]] const bool saved = save_warm_set(); } // Only a hint, failures are reported and that's it
+        return all_written;
+    }
+
+    // Sidecar of the resident set, see BufferPoolOptions::warm_restart. Header then count pids, native endianness
+    struct WarmSetHeader {
+        uint64_t magic;
+        uint64_t page_size;
+        uint64_t count;
+    };
+    static constexpr uint64_t WARM_SET_MAGIC = 0x4250'5741'524D'3031ULL; // "BPWARM01"
+
+    [[nodiscard]] auto warm_set_path() const -> std::filesystem::path { return file_path.string() + ".warm"; }
+
+    // Resident pids, hottest first. Each shard's replacer ranks its own, shards are interleaved by relative rank. Hits other
+    //  threads still have batched aren't counted, at most one AccessBatch each
+    [[nodiscard]] auto resident_by_heat() -> std::vector<page_id_t, PageIDAllocator> {
+        flush_access_batch();
+        using RankedAllocator = typename Traits::template rebind_alloc<std::pair<double, page_id_t>>;
+        std::vector<std::pair<double, page_id_t>, RankedAllocator> ranked{RankedAllocator(allocator_)};
+        std::vector<page_id_t, PageIDAllocator> shard_pids{PageIDAllocator(allocator_)};
+        for (Shard& shard : shards) {
+            shard_pids.clear();
+            {
+                std::lock_guard lock(shard.mu);
+                shard.replacer.for_each_hottest_first([&](const frame_id_t local) {
+                    const page_id_t pid = frame_to_page[shard.first_frame + local].load(std::memory_order_relaxed);
+                    if (pid != INVALID_PID) { shard_pids.push_back(pid); }
+                });
+            }
+            for (size_t i = 0; i < shard_pids.size(); i++) {
+                ranked.emplace_back(static_cast<double>(i) / static_cast<double>(shard_pids.size()), shard_pids[i]);
+            }
+        }
+        std::stable_sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+        std::vector<page_id_t, PageIDAllocator> pids{PageIDAllocator(allocator_)};
+        pids.reserve(ranked.size());
+        for (const auto& [rank, pid] : ranked) { pids.push_back(pid); }
+        return pids;
+    }
+
+    // Saves the resident set for the next pool on this file. Written to a temporary file, synced, and renamed over the old set
+    //  (the directory synced after), so a crash midway leaves the previous one. False (reported) if it couldn't be written
+    [[nodiscard]] auto save_warm_set() -> bool {
+        const std::vector<page_id_t, PageIDAllocator> pids = resident_by_heat();
+        const std::filesystem::path path = warm_set_path();
+        const std::filesystem::path tmp_path = path.string() + ".tmp";
+        {
+            const RAII_FD out(open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+            if (!out.valid()) {
+                perror("BufferPool: warm set open");
+                return false;
+            }
+            WarmSetHeader header{WARM_SET_MAGIC, page_size, pids.size()};
+            std::array<iovec, 2> iovs{iovec{&header, sizeof(header)}, iovec{const_cast<page_id_t*>(pids.data()), pids.size() * sizeof(page_id_t)}};
+            IORequest req{IORequest::WRITE, out.get(), 0, iovs.data(), 2};
+            [[maybe_unused]] const uint64_t syscalls = SyncIOBackend{}.submit_and_wait({&req, 1});
+            if (req.result < 0) {
+                errno = static_cast<int>(-req.result);
+                perror("BufferPool: warm set write");
+                return false;
+            }
+            if (fdatasync(out.get()) != 0) { // Or the rename can reach the disk before the data does
+                perror("BufferPool: warm set fdatasync");
+                return false;
+            }
+        }
+        if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+            perror("BufferPool: warm set rename");
+            return false;
+        }
+        const std::filesystem::path dir = path.has_parent_path() ? path.parent_path() : std::filesystem::path(".");
+        const RAII_FD dir_fd(open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+        if (!dir_fd.valid() || fsync(dir_fd.get()) != 0) {
+            perror("BufferPool: warm set directory fsync");
+            return false;
+        }
+        return true;
+    }
+
+    // Prefetches the set a previous pool saved, hottest first (each batch sorted by pid, runs read as one). Pages whose shard
+    //  is already full are left out rather than evicting warmer ones, that happens when the pool shrank since
+    void prewarm() {
+        const std::filesystem::path path = warm_set_path();
+        const RAII_FD in(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+        if (!in.valid()) { return; } // Nothing saved, cold start
+
+        WarmSetHeader header{};
+        iovec header_iov{&header, sizeof(header)};
+        IORequest header_req{IORequest::READ, in.get(), 0, &header_iov, 1};
+        [[maybe_unused]] const uint64_t header_syscalls = SyncIOBackend{}.submit_and_wait({&header_req, 1});
+        // count comes off disk, a count the file can't hold means it's corrupt. Only the hottest frame_slots are read, the pool
+        //  could never hold more, so a bad hint costs a cold start and nothing bigger than the pool's own bookkeeping
+        struct stat st{};
+        const bool fits = fstat(in.get(), &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(header))
+            && header.count <= (static_cast<uint64_t>(st.st_size) - sizeof(header)) / sizeof(page_id_t);
+        if (header_req.result != static_cast<ssize_t>(sizeof(header)) || header.magic != WARM_SET_MAGIC || header.page_size != page_size || !fits) {
+            std::cerr << "BufferPool: ignoring (" << path.string() << "), not a warm set for this pool\n";
+            return;
+        }
+
+        std::vector<page_id_t, PageIDAllocator> saved(static_cast<size_t>(std::min<uint64_t>(header.count, frame_slots)), 0, PageIDAllocator(allocator_));
+        iovec pids_iov{saved.data(), saved.size() * sizeof(page_id_t)};
+        IORequest pids_req{IORequest::READ, in.get(), static_cast<off_t>(sizeof(header)), &pids_iov, 1};
+        [[maybe_unused]] const uint64_t pids_syscalls = SyncIOBackend{}.submit_and_wait({&pids_req, 1});
+        if (pids_req.result < 0) {
+            errno = static_cast<int>(-pids_req.result);
+            perror("BufferPool: warm set read");
+            return;
+        }
+        saved.resize(static_cast<size_t>(pids_req.result) / sizeof(page_id_t)); // Truncated file, keep what's there
+
+        std::vector<size_t, SizeAllocator> room(shards.size(), 0, SizeAllocator(allocator_));
+        for (size_t i = 0; i < shards.size(); i++) { room[i] = shards[i].frame_count; }
+        std::vector<page_id_t, PageIDAllocator> pids{PageIDAllocator(allocator_)};
+        for (const page_id_t pid : saved) {
+            size_t& left = room[static_cast<size_t>(&shard_of(pid) - &shards[0])];
+            if (left == 0) { continue; }
+            left--;
+            pids.push_back(pid);
+        }
+        prefetch(pids);
+        if (options.warm_restart_wait) { wait_for_prefetches(); }
+    }
+
+    // checkpoint() without the fdatasync
+    [[nodiscard]] auto flush_all() -> bool { return checkpoint(false); }
+
+    // Hint that pids are about to be needed. Whichever aren't resident are read into free or evictable frames in the background,
+    //  io_queue_depth per batch, without pinning them, so later guards on them hit. Returns right away (see prefetch_workers).
+    // Best effort: a page whose shard is fully pinned, or whose read fails, is skipped. Pages loaded this way count as
+    //  accessed for the replacer, don't prefetch more than the pool can hold or the first ones get evicted by the last ones
+    void prefetch(const std::span<const page_id_t> pids) {
+        if (pids.empty()) { return; }
+        if (!prefetcher.has_value()) {
+            load_unpinned(pids);
+            return;
+        }
+        std::vector<page_id_t, PageIDAllocator> todo(pids.begin(), pids.end(), PageIDAllocator(allocator_));
+        give_prefetch([this, todo = std::move(todo)]() { this->load_unpinned(todo); });
     }
 
-    void read_unlock(Page page) noexcept {
-        std::unique_lock<std::mutex> lock(mu);
-        deallocate_page(page.pid, READ, lock);
+    // Blocks until every prefetch() issued so far finished loading
+    void wait_for_prefetches() const noexcept {
+        for (uint32_t pending = prefetches_pending.load(std::memory_order_acquire); pending != 0; pending = prefetches_pending.load(std::memory_order_acquire)) {
+            prefetches_pending.wait(pending, std::memory_order_acquire);
+        }
     }
 
+    [[nodiscard]] auto io_backend_name() const noexcept -> std::string_view { return io->name(); }
+
+    // False if direct I/O wasn't asked for, or couldn't be had (see BufferPoolOptions::direct_io)
+    [[nodiscard]] auto direct_io() const noexcept -> bool { return direct_io_alignment != 0; }
+
+    // Frames in use
+    [[nodiscard]] auto capacity() const noexcept -> size_t { return page_count.load(std::memory_order_relaxed); }
+
+    // Grows the pool to new_page_count frames (at most BufferPoolOptions::max_page_count) with one new chunk of memory, or
+    //  shrinks it by handing chunks back to the allocator, newest first, as long as that keeps it at new_page_count or more.
+    //  A shrinking chunk's dirty pages are written back and its clean ones dropped. One with a frame that's pinned or has
+    //  I/O in flight stops the shrink there, try again later. Guards on the frames that stay are never affected.
+    //  Returns the size the pool ended up at
+    auto resize(const size_t new_page_count) -> size_t {
+        std::lock_guard lock(resize_mu);
+        const size_t target = std::min(new_page_count, max_page_count);
+        size_t current = page_count.load(std::memory_order_relaxed);
+        if (target > current) {
+            try {
+                add_chunk(target - current);
+            } catch (const std::bad_alloc&) {
+                std::cerr << "BufferPool: couldn't allocate (" << target - current << ") more frames\n";
+            }
+            return page_count.load(std::memory_order_relaxed);
+        }
+        // Every shard keeps a frame at least
+        while (!chunks.empty() && current - chunks.back().pages >= std::max(target, shards.size()) && remove_chunk()) {
+            current = page_count.load(std::memory_order_relaxed);
+        }
+        return current;
+    }
 
     // If guards are acquired in 2 different directions by different threads, it will deadlock
     //  i.e. thread 1 acquires pid 0 then pid 1, while thread 2 acquires pid 1 then pid 0
@@ -407,31 +1979,107 @@ class BufferPool {
     // If threads only check out 2 pages in a strictly increasing order and release them in acquisition order, it will never deadlock
     //  This is not true with num threads >= 3. i.e. thread (1) 2, 5, 7; thread (2) 5, 7, 8; thread (3) 7, 8, 9; can deadlock. That might not be the right example idk but 3 threads do deadlock when 2 don't
     //  Might take a very very long time
+    // get_page_guards() takes several pages at once in any order without these problems, as long as the caller holds no
+    //  other page latch. One that does should use try_get_page_guards() / try_get_page_guards_for() and back off on page_in_use
 
     [[nodiscard]] auto get_write_page_guard(const page_id_t pid) -> std::pair<WritePageGuard, PageGuardFailRC> {
-        std::unique_lock bp_lock(mu);
+        return get_write_page_guard_until(pid, NO_DEADLINE);
+    }
 
-        const auto [frame, rc] = get_frame(pid, WRITE, bp_lock);
-        if (rc != ok) { return {WritePageGuard{}, rc}; }
+    [[nodiscard]] auto get_read_page_guard(const page_id_t pid, const AccessHint hint = AccessHint::NORMAL) -> std::pair<ReadPageGuard, PageGuardFailRC> {
+        return get_read_page_guard_until(pid, NO_DEADLINE, hint);
+    }
+
+    // Non blocking versions, page_in_use right away if someone holds a conflicting latch. Nothing held is ever waited on,
+    //  so these can't take part in a deadlock; back off or reorder the work instead. A disk read of the page is still waited for
+    [[nodiscard]] auto try_get_write_page_guard(const page_id_t pid) -> std::pair<WritePageGuard, PageGuardFailRC> {
+        return get_write_page_guard_until(pid, NO_WAIT);
+    }
+
+    [[nodiscard]] auto try_get_read_page_guard(const page_id_t pid, const AccessHint hint = AccessHint::NORMAL) -> std::pair<ReadPageGuard, PageGuardFailRC> {
+        return get_read_page_guard_until(pid, NO_WAIT, hint);
+    }
 
-        increment_frame_accesses(frame);
+    // Timed versions, page_in_use if the latch is still taken at the deadline
+    [[nodiscard]] auto try_get_write_page_guard_for(const page_id_t pid, const std::chrono::nanoseconds timeout) -> std::pair<WritePageGuard, PageGuardFailRC> {
+        return get_write_page_guard_until(pid, std::chrono::steady_clock::now() + timeout);
+    }
 
-        Page page{memory + page_size * frame, page_size, pid};
-        sanity_check(bp_lock);
-        return {WritePageGuard{ [this](Page p) { this->write_unlock(p); }, page}, ok};
+    [[nodiscard]] auto try_get_read_page_guard_for(const page_id_t pid, const std::chrono::nanoseconds timeout, const AccessHint hint = AccessHint::NORMAL)
+        -> std::pair<ReadPageGuard, PageGuardFailRC> {
+        return get_read_page_guard_until(pid, std::chrono::steady_clock::now() + timeout, hint);
     }
 
-    [[nodiscard]] auto get_read_page_guard(const page_id_t pid) -> std::pair<ReadPageGuard, PageGuardFailRC> {
-        std::unique_lock bp_lock(mu);
+    [[nodiscard]] auto get_write_page_guard_until(const page_id_t pid, const Deadline deadline) -> std::pair<WritePageGuard, PageGuardFailRC> {
+        const auto [frame, rc] = get_frame(pid, WRITE, AccessHint::NORMAL, deadline);
+        if (rc != ok) { return {WritePageGuard{}, rc}; }
 
-        const auto [frame, rc] = get_frame(pid, READ, bp_lock);
+        return {WritePageGuard{this, &page_guard_ops, frame, Page{frame_memory[frame], page_size, pid}}, ok};
+    }
+
+    [[nodiscard]] auto get_read_page_guard_until(const page_id_t pid, const Deadline deadline, const AccessHint hint = AccessHint::NORMAL)
+        -> std::pair<ReadPageGuard, PageGuardFailRC> {
+        const auto [frame, rc] = get_frame(pid, READ, hint, deadline);
         if (rc != ok) { return {ReadPageGuard{}, rc}; }
 
-        increment_frame_accesses(frame);
+        return {ReadPageGuard{this, &page_guard_ops, frame, Page{frame_memory[frame], page_size, pid}}, ok};
+    }
+
+    // Loads pid if needed and keeps it resident until the handle is released, without latching it. Counts as an access,
+    //  latching it through the handle doesn't
+    [[nodiscard]] auto get_pinned_page(const page_id_t pid, const AccessHint hint = AccessHint::NORMAL) -> std::pair<PinnedPage, PageGuardFailRC> {
+        const auto [frame, rc] = get_frame(pid, PIN, hint);
+        if (rc != ok) { return {PinnedPage{}, rc}; }
+        return {PinnedPage{this, &page_guard_ops, frame, pid}, ok};
+    }
+
+    // Guards on several pages at once, for the splits / merges / redistributions that touch a few. Whatever order the pids
+    //  come in it can't deadlock with other multi-page calls or single guards, but only if the caller holds no other page
+    //  latch (see latch_frames()). A caller that holds one, e.g. a parent during a split, must use the try / timed versions.
+    //  Resident pages cost one shard lock per shard rather than one per page. Guards come back in the order of their pids, a
+    //  pid must not be asked for twice. All or nothing, on failure the set is empty
+    [[nodiscard]] auto get_page_guards(const std::span<const page_id_t> write_pids, const std::span<const page_id_t> read_pids)
+        -> std::pair<PageGuardSet, PageGuardFailRC> {
+        return get_page_guards_until(write_pids, read_pids, NO_DEADLINE);
+    }
+
+    // page_in_use right away if any of the pages is latched in a conflicting mode, disk reads are still waited for
+    [[nodiscard]] auto try_get_page_guards(const std::span<const page_id_t> write_pids, const std::span<const page_id_t> read_pids)
+        -> std::pair<PageGuardSet, PageGuardFailRC> {
+        return get_page_guards_until(write_pids, read_pids, NO_WAIT);
+    }
 
-        Page page{memory + page_size * frame, page_size, pid};
-        sanity_check(bp_lock);
-        return {ReadPageGuard{ [this](Page p) { this->read_unlock(p); }, page}, ok};
+    [[nodiscard]] auto try_get_page_guards_for(const std::span<const page_id_t> write_pids, const std::span<const page_id_t> read_pids, const std::chrono::nanoseconds timeout)
+        -> std::pair<PageGuardSet, PageGuardFailRC> {
+        return get_page_guards_until(write_pids, read_pids, std::chrono::steady_clock::now() + timeout);
+    }
+
+    [[nodiscard]] auto get_page_guards_until(const std::span<const page_id_t> write_pids, const std::span<const page_id_t> read_pids, const Deadline deadline)
+        -> std::pair<PageGuardSet, PageGuardFailRC> {
+        std::vector<page_id_t, PageIDAllocator> pids{PageIDAllocator(allocator_)};
+        pids.reserve(write_pids.size() + read_pids.size());
+        pids.insert(pids.end(), write_pids.begin(), write_pids.end());
+        pids.insert(pids.end(), read_pids.begin(), read_pids.end());
+        std::vector<frame_id_t, FrameIDAllocator> frames(pids.size(), -1, FrameIDAllocator(allocator_));
+        if (const PageGuardFailRC rc = get_frames(pids, write_pids.size(), frames, deadline); rc != ok) { return {PageGuardSet{}, rc}; }
+
+        PageGuardSet set;
+        set.write.reserve(write_pids.size());
+        set.read.reserve(read_pids.size());
+        for (size_t i = 0; i < pids.size(); i++) {
+            const Page page{frame_memory[frames[i]], page_size, pids[i]};
+            if (i < write_pids.size()) {
+                set.write.emplace_back(this, &page_guard_ops, frames[i], page);
+            } else {
+                set.read.emplace_back(this, &page_guard_ops, frames[i], page);
+            }
+        }
+        return {std::move(set), ok};
+    }
+
+    [[nodiscard]] auto get_write_page_guards(const std::span<const page_id_t> pids) -> std::pair<std::vector<WritePageGuard>, PageGuardFailRC> {
+        auto [set, rc] = get_page_guards(pids, {});
+        return {std::move(set.write), rc};
     }
 };
 
@@ -439,4 +2087,7 @@ class BufferPool {
 using PMRBufferPool = BufferPool<std::pmr::polymorphic_allocator<char>>;
 
 BufferPool(std::filesystem::path, size_t, size_t, std::pmr::memory_resource*) 
+    -> BufferPool<std::pmr::polymorphic_allocator<std::byte>>;
+
+BufferPool(std::filesystem::path, size_t, size_t, std::pmr::memory_resource*, BufferPoolOptions) 
     -> BufferPool<std::pmr::polymorphic_allocator<std::byte>>;
\ No newline at end of file
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+// Shared / exclusive latch with a version for optimistic readers (LeanStore's hybrid latch). The version is odd while the
+//  latch is held exclusively and moves on to the next even number on release, so a reader that saw the same even version
+//  before and after reading knows no writer touched the data meanwhile. Optimistic readers write nothing shared, a hot page
+//  read from many cores stays in every core's cache instead of bouncing between them like a shared_mutex's reader count.
+// Otherwise the std::shared_timed_mutex interface (readers first, like glibc's), plus try_upgrade() / downgrade(). Blocking
+//  goes through atomic wait, i.e. a futex
+class HybridLatch {
+    static constexpr uint32_t EXCLUSIVE = 1u << 31;
+    std::atomic<uint32_t> state{0};   // EXCLUSIVE, or the number of shared holders
+    std::atomic<uint64_t> version{0}; // Only changed by the exclusive holder
+
+    void begin_write() noexcept {
+        version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release); // Odd version visible before any of the writes
+    }
+
+    void end_write() noexcept {
+        version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Atomic wait has no timeout, so the timed locks poll, backing off from 1us to 1ms
+    template <typename Clock, typename Duration, typename Attempt>
+    [[nodiscard]] static bool retry_until(const std::chrono::time_point<Clock, Duration>& deadline, Attempt&& attempt) {
+        constexpr std::chrono::microseconds max_backoff{1000};
+        std::chrono::microseconds backoff{1};
+        while (!attempt()) {
+            const auto now = Clock::now();
+            if (now >= deadline) { return false; }
+            std::this_thread::sleep_for(std::min(backoff, std::chrono::duration_cast<std::chrono::microseconds>(deadline - now)));
+            backoff = std::min(backoff * 2, max_backoff);
+        }
+        return true;
+    }
+
+    public:
+    void lock() noexcept {
+        uint32_t expected = 0;
+        while (!state.compare_exchange_weak(expected, EXCLUSIVE, std::memory_order_acquire, std::memory_order_relaxed)) {
+            if (expected != 0) { state.wait(expected, std::memory_order_relaxed); }
+            expected = 0;
+        }
+        begin_write();
+    }
+
+    [[nodiscard]] bool try_lock() noexcept {
+        uint32_t expected = 0;
+        if (!state.compare_exchange_strong(expected, EXCLUSIVE, std::memory_order_acquire, std::memory_order_relaxed)) { return false; }
+        begin_write();
+        return true;
+    }
+
+    template <typename Clock, typename Duration>
+    [[nodiscard]] bool try_lock_until(const std::chrono::time_point<Clock, Duration>& deadline) {
+        return retry_until(deadline, [this]() { return try_lock(); });
+    }
+
+    void unlock() noexcept {
+        end_write();
+        state.store(0, std::memory_order_release);
+        state.notify_all();
+    }
+
+    void lock_shared() noexcept {
+        uint32_t current = state.load(std::memory_order_relaxed);
+        while (true) {
+            if ((current & EXCLUSIVE) != 0) {
+                state.wait(current, std::memory_order_relaxed);
+                current = state.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (state.compare_exchange_weak(current, current + 1, std::memory_order_acquire, std::memory_order_relaxed)) { return; }
+        }
+    }
+
+    [[nodiscard]] bool try_lock_shared() noexcept {
+        uint32_t current = state.load(std::memory_order_relaxed);
+        while ((current & EXCLUSIVE) == 0) {
+            if (state.compare_exchange_weak(current, current + 1, std::memory_order_acquire, std::memory_order_relaxed)) { return true; }
+        }
+        return false;
+    }
+
+    template <typename Clock, typename Duration>
+    [[nodiscard]] bool try_lock_shared_until(const std::chrono::time_point<Clock, Duration>& deadline) {
+        return retry_until(deadline, [this]() { return try_lock_shared(); });
+    }
+
+    void unlock_shared() noexcept {
+        if (state.fetch_sub(1, std::memory_order_release) == 1) { state.notify_all(); } // Only writers wait on readers
+    }
+
+    // Shared -> exclusive, only if the caller is the one reader. Never waits: two readers that both waited for the other
+    //  to leave would deadlock, so the loser gets false and still holds its shared latch
+    [[nodiscard]] bool try_upgrade() noexcept {
+        uint32_t expected = 1;
+        if (!state.compare_exchange_strong(expected, EXCLUSIVE, std::memory_order_acquire, std::memory_order_relaxed)) { return false; }
+        begin_write();
+        return true;
+    }
+
+    // Exclusive -> shared, without letting another writer in between
+    void downgrade() noexcept {
+        end_write();
+        state.store(1, std::memory_order_release);
+        state.notify_all(); // Readers waiting on the writer can come in
+    }
+
+    // Start of an optimistic read. Odd means a writer has it, validate() will fail
+    [[nodiscard]] auto optimistic_version() const noexcept -> uint64_t { return version.load(std::memory_order_acquire); }
+
+    // End of an optimistic read started at seen. True if nothing was written in between
+    [[nodiscard]] auto validate(const uint64_t seen) const noexcept -> bool {
+        std::atomic_thread_fence(std::memory_order_acquire); // The reads of the data stay before the version check
+        return (seen & 1) == 0 && version.load(std::memory_order_relaxed) == seen;
+    }
+};
+
+// Copies bytes a writer may be changing at the same time. Only for optimistic reads, which throw away what they read when
+//  the version moved, so the race is expected. Hidden from ThreadSanitizer for that reason
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((no_sanitize("thread")))
+#endif
+inline void optimistic_copy(char* const out, const char* const in, const size_t n) noexcept {
+    for (size_t i = 0; i < n; i++) { out[i] = in[i]; }
+}
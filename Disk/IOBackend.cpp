@@ -0,0 +1,359 @@
+#include "IOBackend.h"
+#include "ThreadPool.h"
+#include "macros.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <thread>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+
+namespace {
+
+// Moves req past n bytes that made it to/from disk
+void advance(IORequest& req, size_t n) noexcept {
+    req.done += n;
+    req.offset += static_cast<off_t>(n);
+    while (n > 0 && req.iovcnt > 0) {
+        if (n >= req.iov->iov_len) {
+            n -= req.iov->iov_len;
+            req.iov++;
+            req.iovcnt--;
+        } else {
+            req.iov->iov_base = static_cast<char*>(req.iov->iov_base) + n;
+            req.iov->iov_len -= n;
+            n = 0;
+        }
+    }
+    while (req.iovcnt > 0 && req.iov->iov_len == 0) { req.iov++; req.iovcnt--; }
+}
+
+// Runs req to completion on the calling thread. Returns the syscalls it took
+auto perform_sync(IORequest& req) noexcept -> uint64_t {
+    uint64_t syscalls = 0;
+    req.done = 0;
+    while (req.iovcnt > 0) {
+        syscalls++;
+        const int iovcnt = std::min(req.iovcnt, IOV_MAX);
+        const ssize_t n = req.op == IORequest::READ ? preadv(req.fd, req.iov, iovcnt, req.offset)
+                                                    : pwritev(req.fd, req.iov, iovcnt, req.offset);
+        if (n < 0) {
+            if (errno == EINTR) { continue; }
+            req.result = -errno;
+            return syscalls;
+        }
+        if (n == 0) {
+            if (req.op == IORequest::READ) { break; } // EOF
+            req.result = -EIO; // Write that can't make progress
+            return syscalls;
+        }
+        advance(req, static_cast<size_t>(n));
+    }
+    req.result = static_cast<ssize_t>(req.done);
+    return syscalls;
+}
+
+[[nodiscard]] int sys_io_uring_setup(const unsigned entries, io_uring_params* params) noexcept {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+[[nodiscard]] int sys_io_uring_enter(const int fd, const unsigned to_submit, const unsigned min_complete, const unsigned flags) noexcept {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+} // namespace
+
+
+
+auto SyncIOBackend::submit_and_wait(std::span<IORequest> requests) -> uint64_t {
+    uint64_t syscalls = 0;
+    for (IORequest& req : requests) { syscalls += perform_sync(req); }
+    return syscalls;
+}
+
+
+
+struct ThreadPoolIOBackend::Impl {
+    ThreadPool<> pool;
+    explicit Impl(const size_t num_workers) : pool(num_workers) {}
+};
+
+ThreadPoolIOBackend::ThreadPoolIOBackend(const size_t num_workers) : impl(std::make_unique<Impl>(num_workers)) {}
+ThreadPoolIOBackend::~ThreadPoolIOBackend() = default;
+
+auto ThreadPoolIOBackend::submit_and_wait(std::span<IORequest> requests) -> uint64_t {
+    if (requests.empty()) { return 0; }
+    IOBatch batch(requests.size());
+    std::atomic<uint64_t> syscalls{0}; // Made by the workers on our behalf
+    for (IORequest& req : requests) {
+        req.batch = &batch;
+        impl->pool.give_work([&req, &syscalls]() {
+            syscalls.fetch_add(perform_sync(req), std::memory_order_relaxed);
+            req.batch->complete_one();
+        });
+    }
+    batch.wait();
+    return syscalls.load(std::memory_order_relaxed);
+}
+
+
+
+// Mapped SQ/CQ rings. head/tail words are shared with the kernel, hence the atomic_refs. SQ side is guarded by sq_mu,
+// the CQ side belongs to the reaper thread. in_flight is kept <= cq_entries so the CQ can never overflow
+struct IOUringBackend::Ring {
+    int fd = -1;
+    unsigned sq_entries = 0;
+    unsigned cq_entries = 0;
+
+    void* sq_map = MAP_FAILED;
+    size_t sq_map_size = 0;
+    void* cq_map = MAP_FAILED;
+    size_t cq_map_size = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqes_size = 0;
+
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_mask = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned* cq_mask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    std::mutex sq_mu;
+    std::condition_variable space_cv;
+    unsigned in_flight = 0; // Guarded by sq_mu
+    // Orders a submitter's writes to its requests before the reaper's reads of them. The trip through the kernel does that
+    //  in practice, but nothing the memory model (or TSAN) can see
+    std::atomic<uint64_t> submit_epoch{0};
+    std::thread reaper;
+
+    Ring() = default;
+    Ring(const Ring&) = delete;
+    Ring& operator=(const Ring&) = delete;
+
+    ~Ring() {
+        if (sqes != MAP_FAILED) { munmap(sqes, sqes_size); }
+        if (cq_map != MAP_FAILED && cq_map != sq_map) { munmap(cq_map, cq_map_size); }
+        if (sq_map != MAP_FAILED) { munmap(sq_map, sq_map_size); }
+        if (fd >= 0) { close(fd); }
+    }
+
+    // Fills one SQE, false if the SQ is full. user_data 0 is the reaper's stop signal
+    [[nodiscard]] auto push(IORequest* req) noexcept -> bool {
+        const unsigned tail = *sq_tail; // Only ever written by us
+        const unsigned head = std::atomic_ref<unsigned>(*sq_head).load(std::memory_order_acquire);
+        if (tail - head == sq_entries) { return false; }
+
+        const unsigned index = tail & *sq_mask;
+        io_uring_sqe& sqe = sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        if (req == nullptr) {
+            sqe.opcode = IORING_OP_NOP;
+        } else {
+            sqe.opcode = req->op == IORequest::READ ? IORING_OP_READV : IORING_OP_WRITEV;
+            sqe.fd = req->fd;
+            sqe.off = static_cast<uint64_t>(req->offset);
+            sqe.addr = reinterpret_cast<uint64_t>(req->iov);
+            sqe.len = static_cast<uint32_t>(std::min(req->iovcnt, IOV_MAX));
+            sqe.user_data = reinterpret_cast<uint64_t>(req);
+        }
+        sq_array[index] = index;
+        std::atomic_ref<unsigned>(*sq_tail).store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Hands every pushed SQE to the kernel. Returns the syscalls it took
+    auto flush(std::unique_lock<std::mutex>& lock) -> uint64_t {
+        uint64_t syscalls = 0;
+        while (true) {
+            const unsigned pending = *sq_tail - std::atomic_ref<unsigned>(*sq_head).load(std::memory_order_acquire);
+            if (pending == 0) { return syscalls; }
+            syscalls++;
+            submit_epoch.fetch_add(1, std::memory_order_release);
+            if (sys_io_uring_enter(fd, pending, 0, 0) >= 0) { continue; }
+            if (errno == EINTR) { continue; }
+            if (errno == EAGAIN || errno == EBUSY) { // Out of kernel resources for the moment
+                lock.unlock();
+                std::this_thread::yield();
+                lock.lock();
+                continue;
+            }
+            perror("io_uring_enter");
+            FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("IOUringBackend: failed to submit");
+        }
+    }
+
+    void submit_one(IORequest* req, std::unique_lock<std::mutex>& lock) {
+        while (!push(req)) { flush(lock); }
+        flush(lock);
+    }
+
+    // False if the request is finished, true if the rest of it was resubmitted
+    [[nodiscard]] auto handle_completion(IORequest& req, const int res) -> bool {
+        if (res == -EINTR || res == -EAGAIN) {
+            std::unique_lock lock(sq_mu);
+            submit_one(&req, lock);
+            return true;
+        }
+        if (res < 0) {
+            req.result = res;
+            return false;
+        }
+        if (res == 0) {
+            req.result = req.op == IORequest::READ ? static_cast<ssize_t>(req.done) : -EIO; // EOF, or a write that can't progress
+            return false;
+        }
+        advance(req, static_cast<size_t>(res));
+        if (req.iovcnt == 0) {
+            req.result = static_cast<ssize_t>(req.done);
+            return false;
+        }
+        std::unique_lock lock(sq_mu); // Short transfer
+        submit_one(&req, lock);
+        return true;
+    }
+
+    void reap() {
+        while (true) {
+            if (sys_io_uring_enter(fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+                perror("io_uring_enter");
+                FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("IOUringBackend: failed to wait for completions");
+            }
+
+            unsigned head = *cq_head; // Only ever written by us
+            const unsigned tail = std::atomic_ref<unsigned>(*cq_tail).load(std::memory_order_acquire);
+            [[maybe_unused]] const uint64_t epoch = submit_epoch.load(std::memory_order_acquire);
+            unsigned finished = 0;
+            bool stop = false;
+            for (; head != tail; head++) {
+                const io_uring_cqe cqe = cqes[head & *cq_mask];
+                if (cqe.user_data == 0) {
+                    stop = true;
+                    continue;
+                }
+                IORequest& req = *reinterpret_cast<IORequest*>(cqe.user_data);
+                if (handle_completion(req, cqe.res)) { continue; }
+                finished++;
+                req.batch->complete_one(); // req may be gone after this
+            }
+            std::atomic_ref<unsigned>(*cq_head).store(head, std::memory_order_release);
+
+            if (finished > 0) {
+                {
+                    std::lock_guard lock(sq_mu);
+                    in_flight -= finished;
+                }
+                space_cv.notify_all();
+            }
+            if (stop) { return; }
+        }
+    }
+};
+
+IOUringBackend::IOUringBackend(std::unique_ptr<Ring> ring) noexcept : ring(std::move(ring)) {}
+
+IOUringBackend::~IOUringBackend() {
+    {
+        std::unique_lock lock(ring->sq_mu);
+        ring->submit_one(nullptr, lock); // NOP with user_data 0 stops the reaper
+    }
+    ring->reaper.join();
+}
+
+auto IOUringBackend::create(const unsigned queue_depth) -> std::unique_ptr<IOUringBackend> {
+    auto ring = std::make_unique<Ring>();
+
+    io_uring_params params{};
+    ring->fd = sys_io_uring_setup(std::bit_ceil(std::clamp(queue_depth, 1u, 4096u)), &params);
+    if (ring->fd < 0) { return nullptr; }
+    ring->sq_entries = params.sq_entries;
+    ring->cq_entries = params.cq_entries;
+
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) { ring->sq_map_size = ring->cq_map_size = std::max(ring->sq_map_size, ring->cq_map_size); }
+
+    ring->sq_map = mmap(nullptr, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) { return nullptr; }
+    ring->cq_map = single_mmap ? ring->sq_map
+                               : mmap(nullptr, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_map == MAP_FAILED) { return nullptr; }
+    ring->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    ring->sqes = static_cast<io_uring_sqe*>(mmap(nullptr, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES));
+    if (ring->sqes == MAP_FAILED) { return nullptr; }
+
+    char* const sq = static_cast<char*>(ring->sq_map);
+    char* const cq = static_cast<char*>(ring->cq_map);
+    ring->sq_head  = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    ring->sq_tail  = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    ring->sq_mask  = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    ring->sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    ring->cq_head  = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    ring->cq_tail  = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    ring->cq_mask  = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    ring->cqes     = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    Ring* const raw = ring.get();
+    ring->reaper = std::thread([raw]() { raw->reap(); });
+    return std::unique_ptr<IOUringBackend>(new IOUringBackend(std::move(ring)));
+}
+
+auto IOUringBackend::submit_and_wait(std::span<IORequest> requests) -> uint64_t {
+    if (requests.empty()) { return 0; }
+    IOBatch batch(requests.size());
+    uint64_t syscalls = 0;
+
+    std::unique_lock lock(ring->sq_mu);
+    for (IORequest& req : requests) {
+        req.batch = &batch;
+        req.done = 0;
+        if (req.iovcnt == 0) {
+            req.result = 0;
+            batch.complete_one();
+            continue;
+        }
+        if (ring->in_flight == ring->cq_entries) { // CQ would overflow, get ours going and wait for room
+            syscalls += ring->flush(lock);
+            ring->space_cv.wait(lock, [this]() { return ring->in_flight < ring->cq_entries; });
+        }
+        while (!ring->push(&req)) { syscalls += ring->flush(lock); }
+        ring->in_flight++;
+    }
+    syscalls += ring->flush(lock);
+    lock.unlock();
+
+    batch.wait();
+    return syscalls;
+}
+
+
+
+auto make_io_backend(const IOBackendKind kind, const size_t queue_depth) -> std::unique_ptr<IOBackend> {
+    switch (kind) {
+        case IOBackendKind::SYNC:
+            return std::make_unique<SyncIOBackend>();
+        case IOBackendKind::IO_URING:
+            if (auto ring = IOUringBackend::create(static_cast<unsigned>(std::min<size_t>(queue_depth, UINT_MAX))); ring != nullptr) {
+                return ring;
+            }
+            [[fallthrough]];
+        case IOBackendKind::THREAD_POOL: {
+            const size_t workers = std::clamp<size_t>(std::thread::hardware_concurrency() * 2, 2, std::max<size_t>(queue_depth, 2));
+            return std::make_unique<ThreadPoolIOBackend>(workers);
+        }
+    }
+    FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("make_io_backend: unknown IOBackendKind");
+    return nullptr;
+}
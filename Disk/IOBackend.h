@@ -0,0 +1,111 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string_view>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+
+
+// One positioned read or write of a file range into (or out of) caller owned buffers.
+// The backend consumes iov in place, it's advanced past whatever was already transferred on a short read/write, so don't
+// reuse the array without refilling it
+struct IORequest {
+    enum Op : uint8_t { READ, WRITE };
+
+    Op op;
+    int fd;
+    off_t offset;
+    iovec* iov;
+    int iovcnt;
+
+    // Out. Bytes transferred, or -errno. Only a read that hits EOF comes back short
+    ssize_t result = 0;
+
+    // Backend bookkeeping
+    struct IOBatch* batch = nullptr;
+    size_t done = 0;
+};
+
+// Completion of a set of requests. Notified under the lock, so the waiter can destroy it as soon as wait() returns
+struct IOBatch {
+    std::mutex mu;
+    std::condition_variable cv;
+    size_t remaining;
+
+    explicit IOBatch(const size_t count) noexcept : remaining(count) {}
+
+    void complete_one() {
+        std::lock_guard lock(mu);
+        if (--remaining == 0) { cv.notify_all(); }
+    }
+
+    void wait() {
+        std::unique_lock lock(mu);
+        cv.wait(lock, [this]() { return remaining == 0; });
+    }
+};
+
+// Where BufferPool's disk traffic goes. Thread safe, any number of threads may have batches in flight at once
+class IOBackend {
+    public:
+    virtual ~IOBackend() = default;
+
+    // Starts every request, returns once all of them completed (successfully or not, see IORequest::result). Requests of
+    //  one batch are in flight together. Returns the number of syscalls the calling thread made for it
+    [[nodiscard]] virtual auto submit_and_wait(std::span<IORequest> requests) -> uint64_t = 0;
+
+    [[nodiscard]] virtual auto name() const noexcept -> std::string_view = 0;
+};
+
+enum class IOBackendKind {
+    SYNC,        // preadv/pwritev on the calling thread, one request after another
+    IO_URING,    // One ring per backend, falls back to THREAD_POOL if the kernel doesn't have (or allow) io_uring
+    THREAD_POOL, // preadv/pwritev spread over worker threads
+};
+
+// Blocking, a batch costs one syscall per request (more on short transfers)
+class SyncIOBackend final : public IOBackend {
+    public:
+    [[nodiscard]] auto submit_and_wait(std::span<IORequest> requests) -> uint64_t override;
+    [[nodiscard]] auto name() const noexcept -> std::string_view override { return "sync"; }
+};
+
+// Fallback async backend, each request of a batch is a ThreadPool task
+class ThreadPoolIOBackend final : public IOBackend {
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+
+    public:
+    explicit ThreadPoolIOBackend(size_t num_workers);
+    ~ThreadPoolIOBackend() override;
+
+    [[nodiscard]] auto submit_and_wait(std::span<IORequest> requests) -> uint64_t override;
+    [[nodiscard]] auto name() const noexcept -> std::string_view override { return "thread pool"; }
+};
+
+// Raw io_uring (no liburing). Submitters fill SQEs under a lock and enter the ring once per batch (or per sq_entries
+//  requests), a dedicated reaper thread waits on the CQ and completes batches, resubmitting the rest of short transfers
+class IOUringBackend final : public IOBackend {
+    struct Ring;
+    std::unique_ptr<Ring> ring;
+
+    explicit IOUringBackend(std::unique_ptr<Ring> ring) noexcept;
+
+    public:
+    ~IOUringBackend() override;
+
+    // nullptr if the ring can't be set up (old kernel, seccomp, RLIMIT_MEMLOCK...)
+    [[nodiscard]] static auto create(unsigned queue_depth) -> std::unique_ptr<IOUringBackend>;
+
+    [[nodiscard]] auto submit_and_wait(std::span<IORequest> requests) -> uint64_t override;
+    [[nodiscard]] auto name() const noexcept -> std::string_view override { return "io_uring"; }
+};
+
+[[nodiscard]] auto make_io_backend(IOBackendKind kind, size_t queue_depth) -> std::unique_ptr<IOBackend>;
@@ -1,89 +1,285 @@
 #pragma once
 
 #include "Page.h"
+#include "HybridLatch.h"
 #include "macros.h"
 
 #include <cstddef>
+#include <cstdint>
 #include <string_view>
-#include <functional>
 #include <cstring>
+#include <span>
 #include <utility>
+#include <optional>
+#include <vector>
 
-// Holds lock until dtor is called
+class ReadPageGuard;
+class WritePageGuard;
+class OptimisticReadGuard;
+
+// Guards hold the pool as a plain pointer plus the frame, and reach the pool through a static table of its functions (one
+//  per pool instantiation, fixed when the guard is made). Nothing to allocate or type erase, a move copies a few words, so
+//  they're cheap to make, pass around and drop on every page access. A null pool means the guard is empty
+struct PageGuardOps {
+    void (*release_read)(void* pool, frame_id_t frame) noexcept;
+    void (*release_write)(void* pool, frame_id_t frame, bool modified) noexcept;
+    bool (*try_upgrade)(void* pool, frame_id_t frame) noexcept;             // Shared latch -> exclusive, false if another reader has it
+    void (*downgrade)(void* pool, frame_id_t frame, bool modified) noexcept; // Exclusive latch -> shared
+
+    // PinnedPage's
+    void (*unpin)(void* pool, frame_id_t frame) noexcept;
+    ReadPageGuard (*read_guard)(void* pool, frame_id_t frame, page_id_t pid);
+    WritePageGuard (*write_guard)(void* pool, frame_id_t frame, page_id_t pid);
+    OptimisticReadGuard (*optimistic_read_guard)(void* pool, frame_id_t frame, page_id_t pid);
+};
+
+// Holds lock until dtor is called. Only a write() marks the page dirty, release hands that on so clean pages are never written back
 class WritePageGuard {
-    std::function<void(Page&)> release_func;
-    bool valid;
-    Page page;
+    void* pool = nullptr;
+    const PageGuardOps* ops = nullptr;
+    char* data = nullptr;
+    uint32_t page_size = 0;
+    page_id_t page_id = 0;
+    frame_id_t frame = -1;
+    bool dirty = false;
+
     public:
-    explicit WritePageGuard() noexcept : page(nullptr, 0, 0), valid(false) {}
-    explicit WritePageGuard(std::function<void(Page&)> release_func, Page page) noexcept : release_func(std::move(release_func)), page(page), valid(true) {}
+    explicit WritePageGuard() noexcept = default;
+    explicit WritePageGuard(void* pool, const PageGuardOps* ops, const frame_id_t frame, const Page page) noexcept
+        : pool(pool), ops(ops), data(page.data), page_size(static_cast<uint32_t>(page.page_size)), page_id(page.pid), frame(frame) {}
 
     // Disable copy ctor and copy assignment
     WritePageGuard(const WritePageGuard&) = delete;
     WritePageGuard& operator=(const WritePageGuard&) = delete;
 
     // Move Ctor
-    WritePageGuard(WritePageGuard&& other) noexcept : release_func(std::move(other.release_func)), page(other.page), valid(other.valid) {
-        other.valid = false;
-    };
+    WritePageGuard(WritePageGuard&& other) noexcept
+        : pool(std::exchange(other.pool, nullptr)), ops(other.ops), data(other.data), page_size(other.page_size), page_id(other.page_id),
+          frame(other.frame), dirty(other.dirty) {}
 
     // Move assignment
-    WritePageGuard& operator=(WritePageGuard&& other) noexcept;
+    WritePageGuard& operator=(WritePageGuard&& other) noexcept {
+        if (this != &other) {
+            release();
+            pool = std::exchange(other.pool, nullptr);
+            ops = other.ops;
+            data = other.data;
+            page_size = other.page_size;
+            page_id = other.page_id;
+            frame = other.frame;
+            dirty = other.dirty;
+        }
+        return *this;
+    }
 
-    ~WritePageGuard() noexcept;
-    void release() noexcept;
+    ~WritePageGuard() noexcept { release(); }
+
+    void release() noexcept {
+        if (pool != nullptr) { ops->release_write(std::exchange(pool, nullptr), frame, dirty); }
+    }
+
+    // Trades the write latch for a read latch on the same page, no other writer gets in between. What was written stays
+    //  marked dirty. Leaves this guard empty
+    [[nodiscard]] auto downgrade() -> ReadPageGuard;
 
     // Throw if not valid?
     void write(std::string_view msg, const size_t page_offset) {
-        if (!valid) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("WritePageGuard::write(): Attempted to write to an invalid guard"); }
-        if (page_offset >= page.page_size) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("WritePageGuard:write(): OOB offset (" + std::to_string(page_offset) + ") for page size (" + std::to_string(page.page_size) + ")"); }
-        if (msg.size() + page_offset > page.page_size) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("WritePageGuard:write(): OOB write"); }
-        std::memcpy(page.data + page_offset, msg.data(), msg.size());
+        if (pool == nullptr) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("WritePageGuard::write(): Attempted to write to an invalid guard"); }
+        if (page_offset >= page_size) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("WritePageGuard:write(): OOB offset (" + std::to_string(page_offset) + ") for page size (" + std::to_string(page_size) + ")"); }
+        if (msg.size() + page_offset > page_size) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("WritePageGuard:write(): OOB write"); }
+        std::memcpy(data + page_offset, msg.data(), msg.size());
+        dirty = true;
     }
-    
+
     [[nodiscard]] auto read() const -> std::string_view{
-        if (!valid) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("WritePageGuard::read(): Attempted to read an invalid guard"); }
-        return std::string_view{page.data, page.page_size};
+        if (pool == nullptr) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("WritePageGuard::read(): Attempted to read an invalid guard"); }
+        return std::string_view{data, page_size};
     }
 
-    [[nodiscard]] page_id_t pid() const { 
-        if (!valid) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("WritePageGuard::pid(): Attempted to access pid of an invalid guard"); }
-        return page.pid; 
+    [[nodiscard]] page_id_t pid() const {
+        if (pool == nullptr) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("WritePageGuard::pid(): Attempted to access pid of an invalid guard"); }
+        return page_id;
     }
 };
 
 // Holds lock until dtor is called
 class ReadPageGuard {
-    std::function<void(Page&)> release_func;
-    bool valid;
-    Page page;
+    void* pool = nullptr;
+    const PageGuardOps* ops = nullptr;
+    char* data = nullptr; // Only written through after an upgrade
+    uint32_t page_size = 0;
+    page_id_t page_id = 0;
+    frame_id_t frame = -1;
+
     public:
-    explicit ReadPageGuard() noexcept : page(0, 0, 0), valid(false) {}
-    explicit ReadPageGuard(std::function<void(Page&)> release_func, Page page) noexcept : release_func(std::move(release_func)), page(page), valid(true) {}
+    explicit ReadPageGuard() noexcept = default;
+    explicit ReadPageGuard(void* pool, const PageGuardOps* ops, const frame_id_t frame, const Page page) noexcept
+        : pool(pool), ops(ops), data(page.data), page_size(static_cast<uint32_t>(page.page_size)), page_id(page.pid), frame(frame) {}
 
     // Disable copy ctor and copy assignment
     ReadPageGuard(const ReadPageGuard&) = delete;
     ReadPageGuard& operator=(const ReadPageGuard&) = delete;
 
     // Move Ctor
-    ReadPageGuard(ReadPageGuard&& other) noexcept : release_func(std::move(other.release_func)), page(other.page), valid(other.valid) {
-        other.valid = false;
-    };
+    ReadPageGuard(ReadPageGuard&& other) noexcept
+        : pool(std::exchange(other.pool, nullptr)), ops(other.ops), data(other.data), page_size(other.page_size), page_id(other.page_id),
+          frame(other.frame) {}
 
     // Move assignment
-    ReadPageGuard& operator=(ReadPageGuard&& other) noexcept;
+    ReadPageGuard& operator=(ReadPageGuard&& other) noexcept {
+        if (this != &other) {
+            release();
+            pool = std::exchange(other.pool, nullptr);
+            ops = other.ops;
+            data = other.data;
+            page_size = other.page_size;
+            page_id = other.page_id;
+            frame = other.frame;
+        }
+        return *this;
+    }
+
+    ~ReadPageGuard() noexcept { release(); }
 
-    ~ReadPageGuard() noexcept;
-    void release() noexcept;
+    void release() noexcept {
+        if (pool != nullptr) { ops->release_read(std::exchange(pool, nullptr), frame); }
+    }
+
+    // Trades the read latch for the write latch if no one else is reading the page, and leaves this guard empty. Otherwise
+    //  nullopt and this guard still holds its read latch. Never waits, two readers both waiting to upgrade would deadlock.
+    //  On nullopt, release and take a write guard instead, and check again whatever the read decided on
+    [[nodiscard]] auto try_upgrade() -> std::optional<WritePageGuard>;
 
     // Throw if not valid?
     [[nodiscard]] auto read() const -> std::string_view{
-        if (!valid) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("ReadPageGuard::read(): Attempted to read an invalid guard"); }
-        return std::string_view{page.data, page.page_size};
+        if (pool == nullptr) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("ReadPageGuard::read(): Attempted to read an invalid guard"); }
+        return std::string_view{data, page_size};
+    }
+
+    [[nodiscard]] page_id_t pid() const {
+        if (pool == nullptr) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("readPageGuard::pid(): Attempted to access pid of an invalid guard"); }
+        return page_id;
+    }
+};
+
+inline auto WritePageGuard::downgrade() -> ReadPageGuard {
+    if (pool == nullptr) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("WritePageGuard::downgrade(): Attempted to downgrade an invalid guard"); }
+    ops->downgrade(pool, frame, dirty);
+    return ReadPageGuard{std::exchange(pool, nullptr), ops, frame, Page{data, page_size, page_id}}; // The pin goes along
+}
+
+inline auto ReadPageGuard::try_upgrade() -> std::optional<WritePageGuard> {
+    if (pool == nullptr) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("ReadPageGuard::try_upgrade(): Attempted to upgrade an invalid guard"); }
+    if (!ops->try_upgrade(pool, frame)) { return std::nullopt; }
+    return WritePageGuard{std::exchange(pool, nullptr), ops, frame, Page{data, page_size, page_id}};
+}
+
+// Reads a page without writing to anything shared, no pin and no latch. The frame latch's version is taken when the guard
+//  is made and checked by validate(), what was read in between only counts if it still matches (a writer may have been
+//  halfway through). Comes from a PinnedPage, whose pin keeps the frame's memory in place, and is good until that's released.
+//  Retry with restart(), or fall back to a ReadPageGuard when writers keep getting in the way
+class OptimisticReadGuard {
+    const HybridLatch* latch = nullptr;
+    const char* data = nullptr;
+    uint32_t page_size = 0;
+    page_id_t page_id = 0;
+    uint64_t version = 1; // Odd never validates
+
+    public:
+    explicit OptimisticReadGuard() noexcept = default;
+    explicit OptimisticReadGuard(const HybridLatch* latch, const Page page) noexcept
+        : latch(latch), data(page.data), page_size(static_cast<uint32_t>(page.page_size)), page_id(page.pid), version(latch->optimistic_version()) {}
+
+    // Copies out.size() bytes from page_offset, then validates
+    [[nodiscard]] auto copy_out(std::span<char> out, const size_t page_offset) const -> bool {
+        if (latch == nullptr) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("OptimisticReadGuard::copy_out(): Attempted to read an invalid guard"); }
+        if (page_offset > page_size || out.size() > page_size - page_offset) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("OptimisticReadGuard::copy_out(): OOB read"); }
+        optimistic_copy(out.data(), data + page_offset, out.size());
+        return validate();
+    }
+
+    // In place, for readers that parse the page where it is. Anything taken from it is only good once validate() is true
+    [[nodiscard]] auto read() const -> std::string_view {
+        if (latch == nullptr) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("OptimisticReadGuard::read(): Attempted to read an invalid guard"); }
+        return std::string_view{data, page_size};
     }
 
-    [[nodiscard]] page_id_t pid() const { 
-        if (!valid) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("readPageGuard::pid(): Attempted to access pid of an invalid guard"); }
-        return page.pid; 
+    [[nodiscard]] auto validate() const noexcept -> bool { return latch != nullptr && latch->validate(version); }
+
+    // Takes the version again, for another try after a failed validate()
+    void restart() noexcept {
+        if (latch != nullptr) { version = latch->optimistic_version(); }
+    }
+
+    [[nodiscard]] page_id_t pid() const {
+        if (latch == nullptr) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("OptimisticReadGuard::pid(): Attempted to access pid of an invalid guard"); }
+        return page_id;
+    }
+};
+
+// Keeps a page resident without latching it. Eviction passes over the frame, readers and writers don't wait on it. Latches
+//  are taken on the handle as guards, each with a pin of its own, so guards and handle can be released in any order.
+//  B+-tree descents keep the path pinned this way and only latch the level they're on
+class PinnedPage {
+    void* pool = nullptr;
+    const PageGuardOps* ops = nullptr;
+    frame_id_t frame = -1;
+    page_id_t page_id = 0;
+
+    public:
+    explicit PinnedPage() noexcept = default;
+    explicit PinnedPage(void* pool, const PageGuardOps* ops, const frame_id_t frame, const page_id_t pid) noexcept : pool(pool), ops(ops), frame(frame), page_id(pid) {}
+
+    // Disable copy ctor and copy assignment
+    PinnedPage(const PinnedPage&) = delete;
+    PinnedPage& operator=(const PinnedPage&) = delete;
+
+    // Move Ctor
+    PinnedPage(PinnedPage&& other) noexcept : pool(std::exchange(other.pool, nullptr)), ops(other.ops), frame(other.frame), page_id(other.page_id) {}
+
+    // Move assignment
+    PinnedPage& operator=(PinnedPage&& other) noexcept {
+        if (this != &other) {
+            release();
+            pool = std::exchange(other.pool, nullptr);
+            ops = other.ops;
+            frame = other.frame;
+            page_id = other.page_id;
+        }
+        return *this;
     }
-};
\ No newline at end of file
+
+    ~PinnedPage() noexcept { release(); }
+
+    void release() noexcept {
+        if (pool != nullptr) { ops->unpin(std::exchange(pool, nullptr), frame); }
+    }
+
+    // Block until the latch is free, same deadlock rules as BufferPool's guards
+    [[nodiscard]] auto read_guard() const -> ReadPageGuard {
+        if (pool == nullptr) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("PinnedPage::read_guard(): Attempted to latch an invalid handle"); }
+        return ops->read_guard(pool, frame, page_id);
+    }
+
+    [[nodiscard]] auto write_guard() const -> WritePageGuard {
+        if (pool == nullptr) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("PinnedPage::write_guard(): Attempted to latch an invalid handle"); }
+        return ops->write_guard(pool, frame, page_id);
+    }
+
+    // Doesn't block or write anything shared, see OptimisticReadGuard. Must not outlive the handle
+    [[nodiscard]] auto optimistic_read_guard() const -> OptimisticReadGuard {
+        if (pool == nullptr) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("PinnedPage::optimistic_read_guard(): Attempted to read an invalid handle"); }
+        return ops->optimistic_read_guard(pool, frame, page_id);
+    }
+
+    [[nodiscard]] page_id_t pid() const {
+        if (pool == nullptr) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("PinnedPage::pid(): Attempted to access pid of an invalid handle"); }
+        return page_id;
+    }
+};
+
+// Guards on several pages taken together, see BufferPool::get_page_guards(). Each in the order its pid was given
+struct PageGuardSet {
+    std::vector<WritePageGuard> write;
+    std::vector<ReadPageGuard> read;
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "Page.h"
+#include "macros.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+
+// pid -> frame, open addressing with linear probing. Writers (insert/erase) must be serialized by the caller (the shard
+// latch), readers call find() with no lock at all.
+// Every slot is one 64 bit atomic holding both the pid and the frame, so a reader either sees a whole entry or none of it.
+// Erase uses backward shift deletion, so a reader racing an erase can miss an entry that was just moved behind it. find()
+// can therefore return a false negative, never a false positive, and callers fall back to the locked path on a miss. The
+// frame a reader gets back may already hold another page by the time it looks, callers validate against the frame's own
+// pid tag after pinning it
+template <typename alloc_t = std::allocator<char>>
+class ConcurrentPageTable {
+    using Traits = std::allocator_traits<alloc_t>;
+    using SlotAllocator = typename Traits::template rebind_alloc<std::atomic<uint64_t>>;
+
+    static constexpr uint64_t EMPTY = ~uint64_t{0}; // pid -1 is never a valid key
+
+    std::vector<std::atomic<uint64_t>, SlotAllocator> slots;
+    const size_t mask;
+    size_t count = 0;
+
+    [[nodiscard]] static constexpr uint64_t pack(const page_id_t pid, const frame_id_t frame) noexcept {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(pid)) << 32) | static_cast<uint32_t>(frame);
+    }
+    [[nodiscard]] static constexpr page_id_t  unpack_pid(const uint64_t entry) noexcept   { return static_cast<page_id_t>(entry >> 32); }
+    [[nodiscard]] static constexpr frame_id_t unpack_frame(const uint64_t entry) noexcept { return static_cast<frame_id_t>(entry & 0xFFFF'FFFFULL); }
+
+    [[nodiscard]] size_t home(const page_id_t pid) const noexcept {
+        // Murmur3 finalizer, the shard is picked with a different hash so pids in one shard still spread here
+        uint64_t h = static_cast<uint32_t>(pid);
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+        return h & mask;
+    }
+
+    [[nodiscard]] size_t find_slot(const page_id_t pid) const noexcept { // Writers only
+        for (size_t i = home(pid), probes = 0; probes <= mask; i = (i + 1) & mask, probes++) {
+            const uint64_t entry = slots[i].load(std::memory_order_relaxed);
+            if (entry == EMPTY) { return slots.size(); }
+            if (unpack_pid(entry) == pid) { return i; }
+        }
+        return slots.size();
+    }
+
+    public:
+    // Sized for at most max_entries live pages, kept at most half full
+    explicit ConcurrentPageTable(const size_t max_entries, const alloc_t& alloc = alloc_t{})
+        : slots(std::bit_ceil(std::max<size_t>(max_entries * 2, 8)), SlotAllocator(alloc)), mask(slots.size() - 1) {
+        for (auto& slot : slots) { slot.store(EMPTY, std::memory_order_relaxed); }
+    }
+
+    ConcurrentPageTable(const ConcurrentPageTable&) = delete;
+    ConcurrentPageTable& operator=(const ConcurrentPageTable&) = delete;
+
+    // Lock free. -1 if not found
+    [[nodiscard]] frame_id_t find(const page_id_t pid) const noexcept {
+        for (size_t i = home(pid), probes = 0; probes <= mask; i = (i + 1) & mask, probes++) {
+            const uint64_t entry = slots[i].load(std::memory_order_acquire);
+            if (entry == EMPTY) { return -1; }
+            if (unpack_pid(entry) == pid) { return unpack_frame(entry); }
+        }
+        return -1;
+    }
+
+    [[nodiscard]] size_t size() const noexcept { return count; }
+
+    void insert(const page_id_t pid, const frame_id_t frame) noexcept {
+        STACK_TRACE_ASSERT(count < slots.size() / 2 + 1);
+        size_t i = home(pid);
+        while (true) {
+            const uint64_t entry = slots[i].load(std::memory_order_relaxed);
+            if (entry == EMPTY || unpack_pid(entry) == pid) { break; }
+            i = (i + 1) & mask;
+        }
+        if (slots[i].load(std::memory_order_relaxed) == EMPTY) { count++; }
+        slots[i].store(pack(pid, frame), std::memory_order_release);
+    }
+
+    void erase(const page_id_t pid) noexcept {
+        size_t i = find_slot(pid);
+        if (i == slots.size()) { return; }
+        count--;
+
+        // Backward shift: pull later entries of the same cluster into the hole, so no tombstones are ever needed
+        size_t j = i;
+        while (true) {
+            j = (j + 1) & mask;
+            const uint64_t entry = slots[j].load(std::memory_order_relaxed);
+            if (entry == EMPTY) { break; }
+            const size_t k = home(unpack_pid(entry));
+            // entry can move to i only if its home is not cyclically inside (i, j]
+            const bool home_between = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+            if (home_between) { continue; }
+            slots[i].store(entry, std::memory_order_release);
+            i = j;
+        }
+        slots[i].store(EMPTY, std::memory_order_release);
+    }
+
+    // Writers only
+    template <typename Func>
+    void for_each(Func&& func) const {
+        for (const auto& slot : slots) {
+            const uint64_t entry = slot.load(std::memory_order_relaxed);
+            if (entry != EMPTY) { func(unpack_pid(entry), unpack_frame(entry)); }
+        }
+    }
+};
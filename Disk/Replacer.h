@@ -0,0 +1,694 @@
+#pragma once
+
+#include "Page.h"
+#include "macros.h"
+
+#include <algorithm>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+
+
+// What BufferPool needs from a replacement policy. All calls are made with the owning shard's lock held.
+//  record_access: frame was handed out for pid. The first access after a load (or after remove/evict) starts tracking it
+//  pin / unpin:   frame is (no longer) in use, pinned frames are never victims. Counted, may nest
+//  remove:        frame's page was dropped without going through evict
+//  evict:         pick an unpinned tracked frame, stop tracking it. nullopt if everything is pinned
+//  evict(claim):  same, but each candidate is offered to claim(frame) first. A candidate the caller refuses (pinned without
+//                 the replacer knowing) is pin()ed by the replacer and the next one is tried, the caller owes it an unpin()
+//  for_each_hottest_first: every tracked frame, roughly the reverse of the order evict() would take them in. Pinned ones first
+template <typename T>
+concept ReplacementPolicy = std::constructible_from<T, size_t> && requires(T& policy, const frame_id_t frame, const page_id_t pid) {
+    { policy.record_access(frame, pid) } -> std::same_as<void>;
+    { policy.pin(frame) } -> std::same_as<void>;
+    { policy.unpin(frame) } -> std::same_as<void>;
+    { policy.remove(frame) } -> std::same_as<void>;
+    { policy.evict() } -> std::same_as<std::optional<frame_id_t>>;
+    { policy.evict([](frame_id_t) { return true; }) } -> std::same_as<std::optional<frame_id_t>>;
+    { policy.size() } -> std::convertible_to<size_t>;
+    { policy.for_each_hottest_first([](frame_id_t) {}) } -> std::same_as<void>;
+};
+
+
+
+// Binary min-heap over frame ids that knows where every frame sits, so a frame can be removed or re-keyed in O(log n).
+// Storage is sized once in the ctor, nothing allocates after that
+template <typename alloc_t, typename less_t>
+class FrameHeap {
+    using Traits = std::allocator_traits<alloc_t>;
+    using FrameIDAllocator = typename Traits::template rebind_alloc<frame_id_t>;
+
+    std::vector<frame_id_t, FrameIDAllocator> heap;
+    std::vector<frame_id_t, FrameIDAllocator> pos; // Frame -> index in heap, -1 if not in the heap
+    less_t less;
+
+    void swap_nodes(const size_t a, const size_t b) noexcept {
+        std::swap(heap[a], heap[b]);
+        pos[heap[a]] = static_cast<frame_id_t>(a);
+        pos[heap[b]] = static_cast<frame_id_t>(b);
+    }
+
+    void sift_up(size_t i) noexcept {
+        while (i > 0) {
+            const size_t parent = (i - 1) / 2;
+            if (!less(heap[i], heap[parent])) { break; }
+            swap_nodes(i, parent);
+            i = parent;
+        }
+    }
+
+    void sift_down(size_t i) noexcept {
+        const size_t n = heap.size();
+        while (true) {
+            const size_t l = 2 * i + 1;
+            const size_t r = l + 1;
+            size_t smallest = i;
+            if (l < n && less(heap[l], heap[smallest])) { smallest = l; }
+            if (r < n && less(heap[r], heap[smallest])) { smallest = r; }
+            if (smallest == i) { break; }
+            swap_nodes(i, smallest);
+            i = smallest;
+        }
+    }
+
+    public:
+    explicit FrameHeap(const size_t frame_count, less_t less, const alloc_t& alloc = alloc_t{})
+        : heap(FrameIDAllocator(alloc)), pos(frame_count, -1, FrameIDAllocator(alloc)), less(less) {
+        heap.reserve(frame_count);
+    }
+
+    [[nodiscard]] bool contains(const frame_id_t frame) const noexcept { return pos[frame] != -1; }
+    [[nodiscard]] bool empty() const noexcept { return heap.empty(); }
+    [[nodiscard]] size_t size() const noexcept { return heap.size(); }
+    [[nodiscard]] frame_id_t top() const noexcept { return heap.front(); }
+
+    void push(const frame_id_t frame) noexcept {
+        STACK_TRACE_ASSERT(!contains(frame));
+        heap.push_back(frame);
+        pos[frame] = static_cast<frame_id_t>(heap.size() - 1);
+        sift_up(heap.size() - 1);
+    }
+
+    void erase(const frame_id_t frame) noexcept {
+        STACK_TRACE_ASSERT(contains(frame));
+        const size_t i = pos[frame];
+        const size_t last = heap.size() - 1;
+        if (i != last) {
+            swap_nodes(i, last);
+        }
+        heap.pop_back();
+        pos[frame] = -1;
+        if (i < heap.size()) {
+            sift_down(i);
+            sift_up(i);
+        }
+    }
+
+    // Key of frame changed
+    void update(const frame_id_t frame) noexcept {
+        STACK_TRACE_ASSERT(contains(frame));
+        const size_t i = pos[frame];
+        sift_down(i);
+        sift_up(pos[frame]);
+    }
+};
+
+
+
+// LRU-K (O'Neil et al.). Victim is the unpinned frame with the largest backward k-distance, i.e. the oldest k-th most
+//  recent access. Frames with < k accesses have an infinite distance and go first, oldest first access first.
+// Every call must be made with the owning BufferPool's lock held. Evictable frames live in a heap keyed on their oldest
+//  retained timestamp, pinned frames are pulled out of it, so evict() is O(log n) and never has to probe a frame latch
+template <typename alloc_t = std::allocator<char>>
+class LRUKReplacer {
+    using Traits = std::allocator_traits<alloc_t>;
+    using U64Allocator  = typename Traits::template rebind_alloc<uint64_t>;
+    using U32Allocator  = typename Traits::template rebind_alloc<uint32_t>;
+    using FrameIDAllocator = typename Traits::template rebind_alloc<frame_id_t>;
+
+    struct KDistanceLess {
+        const LRUKReplacer* replacer;
+        // (has k accesses, oldest retained timestamp) ascending
+        [[nodiscard]] bool operator()(const frame_id_t a, const frame_id_t b) const noexcept {
+            const bool a_full = replacer->access_count[a] >= replacer->k;
+            const bool b_full = replacer->access_count[b] >= replacer->k;
+            if (a_full != b_full) { return !a_full; }
+            return replacer->oldest_access(a) < replacer->oldest_access(b);
+        }
+    };
+
+    const size_t k;
+    uint64_t current_timestamp = 0;
+    std::vector<uint64_t, U64Allocator> history;      // Frame -> ring of its last k access timestamps, frame * k + i
+    std::vector<uint32_t, U32Allocator> access_count; // Frame -> accesses since it was loaded, 0 == not tracked
+    std::vector<uint32_t, U32Allocator> pin_count;    // Frame -> outstanding pins
+    FrameHeap<alloc_t, KDistanceLess> evictable;
+
+    [[nodiscard]] uint64_t oldest_access(const frame_id_t frame) const noexcept {
+        const uint32_t n = access_count[frame];
+        if (n < k) { return history[frame * k]; } // Ring hasn't wrapped yet, slot 0 is the first access
+        return history[frame * k + (n % k)];       // Next slot to be overwritten is the k-th most recent
+    }
+
+    void forget(const frame_id_t frame) noexcept {
+        access_count[frame] = 0;
+        if (evictable.contains(frame)) { evictable.erase(frame); }
+    }
+
+    public:
+    explicit LRUKReplacer(const size_t frame_count, const alloc_t& alloc = alloc_t{}, const size_t k = 2)
+        : k(k), history(frame_count * k, 0, U64Allocator(alloc)), access_count(frame_count, 0, U32Allocator(alloc)), pin_count(frame_count, 0, U32Allocator(alloc)),
+          evictable(frame_count, KDistanceLess{this}, alloc) {
+        if (k == 0) { FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("LRUKReplacer: k must be > 0"); }
+    }
+
+    LRUKReplacer(const LRUKReplacer&) = delete;
+    LRUKReplacer& operator=(const LRUKReplacer&) = delete;
+
+    // Starts tracking frame if it isn't already
+    void record_access(const frame_id_t frame, const page_id_t = 0) noexcept {
+        const uint32_t n = access_count[frame];
+        history[frame * k + (n % k)] = ++current_timestamp;
+        access_count[frame] = n + 1;
+        if (evictable.contains(frame)) {
+            evictable.update(frame);
+        } else if (n == 0 && pin_count[frame] == 0) {
+            evictable.push(frame);
+        }
+    }
+
+    void pin(const frame_id_t frame) noexcept {
+        if (pin_count[frame]++ == 0 && evictable.contains(frame)) {
+            evictable.erase(frame);
+        }
+    }
+
+    void unpin(const frame_id_t frame) noexcept {
+        STACK_TRACE_ASSERT(pin_count[frame] > 0);
+        if (--pin_count[frame] == 0 && access_count[frame] != 0) {
+            evictable.push(frame);
+        }
+    }
+
+    // Frame no longer holds a page
+    void remove(const frame_id_t frame) noexcept {
+        STACK_TRACE_ASSERT(pin_count[frame] == 0);
+        forget(frame);
+    }
+
+    // Picks and stops tracking the victim
+    [[nodiscard]] auto evict() noexcept -> std::optional<frame_id_t> {
+        return evict([](frame_id_t) { return true; });
+    }
+
+    template <typename claim_t>
+    [[nodiscard]] auto evict(claim_t&& try_claim) -> std::optional<frame_id_t> {
+        while (!evictable.empty()) {
+            const frame_id_t victim = evictable.top();
+            if (try_claim(victim)) {
+                forget(victim);
+                return victim;
+            }
+            pin(victim); // Keeps its history, comes back on unpin
+        }
+        return std::nullopt;
+    }
+
+    [[nodiscard]] bool is_pinned(const frame_id_t frame) const noexcept { return pin_count[frame] != 0; }
+
+    // Smallest backward k-distance first. Sorts a copy, O(n log n)
+    template <typename Func>
+    void for_each_hottest_first(Func&& func) const {
+        std::vector<frame_id_t, FrameIDAllocator> frames{FrameIDAllocator(history.get_allocator())};
+        for (size_t frame = 0; frame < access_count.size(); frame++) {
+            if (access_count[frame] != 0) { frames.push_back(static_cast<frame_id_t>(frame)); }
+        }
+        const KDistanceLess less{this};
+        std::sort(frames.begin(), frames.end(), [&](const frame_id_t a, const frame_id_t b) {
+            if (is_pinned(a) != is_pinned(b)) { return is_pinned(a); }
+            return less(b, a);
+        });
+        for (const frame_id_t frame : frames) { func(frame); }
+    }
+
+    // Number of frames evict() could pick from
+    [[nodiscard]] size_t size() const noexcept { return evictable.size(); }
+};
+
+
+
+// Doubly linked list threaded through per frame prev/next arrays, so push/erase/back are O(1) and never allocate.
+// A frame is in at most one list of a given replacer, which one is tracked by the owner
+template <typename alloc_t>
+class FrameList {
+    using Traits = std::allocator_traits<alloc_t>;
+    using FrameIDAllocator = typename Traits::template rebind_alloc<frame_id_t>;
+    using BoolAllocator    = typename Traits::template rebind_alloc<bool>;
+
+    std::vector<frame_id_t, FrameIDAllocator> prev;
+    std::vector<frame_id_t, FrameIDAllocator> next;
+    std::vector<bool, BoolAllocator> linked;
+    frame_id_t head = -1; // MRU
+    frame_id_t tail = -1; // LRU
+    size_t count = 0;
+
+    public:
+    explicit FrameList(const size_t frame_count, const alloc_t& alloc = alloc_t{})
+        : prev(frame_count, -1, FrameIDAllocator(alloc)), next(frame_count, -1, FrameIDAllocator(alloc)), linked(frame_count, false, BoolAllocator(alloc)) {}
+
+    [[nodiscard]] bool contains(const frame_id_t frame) const noexcept { return linked[frame]; }
+    [[nodiscard]] bool empty() const noexcept { return count == 0; }
+    [[nodiscard]] size_t size() const noexcept { return count; }
+    [[nodiscard]] frame_id_t front() const noexcept { return head; }
+    [[nodiscard]] frame_id_t back() const noexcept { return tail; }
+    [[nodiscard]] frame_id_t prev_of(const frame_id_t frame) const noexcept { return prev[frame]; } // Towards MRU, -1 at the head
+    [[nodiscard]] frame_id_t next_of(const frame_id_t frame) const noexcept { return next[frame]; } // Towards LRU, -1 at the tail
+
+    template <typename Func>
+    void for_each_mru_first(Func&& func) const {
+        for (frame_id_t frame = head; frame != -1; frame = next[frame]) { func(frame); }
+    }
+
+    void push_front(const frame_id_t frame) noexcept {
+        STACK_TRACE_ASSERT(!linked[frame]);
+        prev[frame] = -1;
+        next[frame] = head;
+        if (head != -1) { prev[head] = frame; }
+        head = frame;
+        if (tail == -1) { tail = frame; }
+        linked[frame] = true;
+        count++;
+    }
+
+    void erase(const frame_id_t frame) noexcept {
+        STACK_TRACE_ASSERT(linked[frame]);
+        if (prev[frame] != -1) { next[prev[frame]] = next[frame]; } else { head = next[frame]; }
+        if (next[frame] != -1) { prev[next[frame]] = prev[frame]; } else { tail = prev[frame]; }
+        linked[frame] = false;
+        count--;
+    }
+};
+
+// Bounded LRU of page ids that are no longer resident (2Q's A1out, ARC's B1/B2). Only touched on the miss path
+template <typename alloc_t>
+class GhostList {
+    using Traits = std::allocator_traits<alloc_t>;
+    using PIDAllocator  = typename Traits::template rebind_alloc<page_id_t>;
+    using SlotAllocator = typename Traits::template rebind_alloc<frame_id_t>;
+    using MapAllocator  = typename Traits::template rebind_alloc<std::pair<const page_id_t, frame_id_t>>;
+
+    const size_t capacity;
+    std::vector<page_id_t, PIDAllocator> slot_pid; // Slot -> pid it remembers
+    std::vector<frame_id_t, SlotAllocator> free_slots;
+    FrameList<alloc_t> order;                      // Slots, MRU first
+    std::unordered_map<page_id_t, frame_id_t, std::hash<page_id_t>, std::equal_to<page_id_t>, MapAllocator> slot_of;
+
+    public:
+    explicit GhostList(const size_t capacity, const alloc_t& alloc = alloc_t{})
+        : capacity(std::max<size_t>(capacity, 1)), slot_pid(this->capacity, 0, PIDAllocator(alloc)), free_slots(SlotAllocator(alloc)), order(this->capacity, alloc), slot_of(MapAllocator(alloc)) {
+        free_slots.reserve(this->capacity);
+        for (size_t i = this->capacity; i > 0; i--) { free_slots.push_back(static_cast<frame_id_t>(i - 1)); }
+        slot_of.reserve(this->capacity);
+    }
+
+    [[nodiscard]] bool contains(const page_id_t pid) const { return slot_of.contains(pid); }
+    [[nodiscard]] size_t size() const noexcept { return order.size(); }
+
+    void push_front(const page_id_t pid) {
+        if (contains(pid)) { erase(pid); }
+        if (free_slots.empty()) { pop_back(); }
+        const frame_id_t slot = free_slots.back();
+        free_slots.pop_back();
+        slot_pid[slot] = pid;
+        slot_of.emplace(pid, slot);
+        order.push_front(slot);
+    }
+
+    void erase(const page_id_t pid) {
+        const auto it = slot_of.find(pid);
+        if (it == slot_of.end()) { return; }
+        order.erase(it->second);
+        free_slots.push_back(it->second);
+        slot_of.erase(it);
+    }
+
+    void pop_back() {
+        if (order.empty()) { return; }
+        erase(slot_pid[order.back()]);
+    }
+};
+
+
+
+// CLOCK (second chance). Tracked frames sit on a ring, an access sets the frame's reference bit, the hand clears bits as it
+// sweeps and takes the first unpinned frame it finds with the bit already clear. Cheapest bookkeeping of the policies,
+// evict() is O(1) amortized but O(n) when most of the pool is pinned or recently referenced
+template <typename alloc_t = std::allocator<char>>
+class ClockReplacer {
+    using Traits = std::allocator_traits<alloc_t>;
+    using U8Allocator  = typename Traits::template rebind_alloc<uint8_t>;
+    using U32Allocator = typename Traits::template rebind_alloc<uint32_t>;
+
+    enum FrameState : uint8_t { UNTRACKED = 0, TRACKED = 1, REFERENCED = 2 };
+
+    std::vector<uint8_t, U8Allocator> state;
+    std::vector<uint32_t, U32Allocator> pin_count;
+    size_t hand = 0;
+    size_t evictable = 0;
+
+    [[nodiscard]] bool tracked(const frame_id_t frame) const noexcept { return (state[frame] & TRACKED) != 0; }
+
+    public:
+    explicit ClockReplacer(const size_t frame_count, const alloc_t& alloc = alloc_t{})
+        : state(frame_count, UNTRACKED, U8Allocator(alloc)), pin_count(frame_count, 0, U32Allocator(alloc)) {}
+
+    ClockReplacer(const ClockReplacer&) = delete;
+    ClockReplacer& operator=(const ClockReplacer&) = delete;
+
+    void record_access(const frame_id_t frame, const page_id_t = 0) noexcept {
+        if (!tracked(frame) && pin_count[frame] == 0) { evictable++; }
+        state[frame] = TRACKED | REFERENCED;
+    }
+
+    void pin(const frame_id_t frame) noexcept {
+        if (pin_count[frame]++ == 0 && tracked(frame)) { evictable--; }
+    }
+
+    void unpin(const frame_id_t frame) noexcept {
+        STACK_TRACE_ASSERT(pin_count[frame] > 0);
+        if (--pin_count[frame] == 0 && tracked(frame)) { evictable++; }
+    }
+
+    void remove(const frame_id_t frame) noexcept {
+        STACK_TRACE_ASSERT(pin_count[frame] == 0);
+        if (tracked(frame)) { evictable--; }
+        state[frame] = UNTRACKED;
+    }
+
+    [[nodiscard]] auto evict() noexcept -> std::optional<frame_id_t> {
+        return evict([](frame_id_t) { return true; });
+    }
+
+    template <typename claim_t>
+    [[nodiscard]] auto evict(claim_t&& try_claim) -> std::optional<frame_id_t> {
+        // Two sweeps clear every reference bit, so an unpinned frame must turn up. A refused frame gets pinned, which only
+        // shrinks the set, so the budget restarts after each refusal
+        size_t steps = 0;
+        while (evictable != 0) {
+            if (steps++ >= 2 * state.size()) {
+                FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("ClockReplacer: evictable count out of sync with frame state");
+            }
+            const frame_id_t frame = static_cast<frame_id_t>(hand);
+            hand = (hand + 1) % state.size();
+            if (!tracked(frame) || pin_count[frame] != 0) { continue; }
+            if ((state[frame] & REFERENCED) != 0) {
+                state[frame] = TRACKED;
+                continue;
+            }
+            if (!try_claim(frame)) {
+                pin(frame);
+                steps = 0;
+                continue;
+            }
+            remove(frame);
+            return frame;
+        }
+        return std::nullopt;
+    }
+
+    [[nodiscard]] size_t size() const noexcept { return evictable; }
+
+    // Pinned, then referenced, then the rest, each in the order the hand will reach them last
+    template <typename Func>
+    void for_each_hottest_first(Func&& func) const {
+        const auto sweep = [&](const auto& pick) {
+            for (size_t i = state.size(); i > 0; i--) {
+                const frame_id_t frame = static_cast<frame_id_t>((hand + i - 1) % state.size());
+                if (tracked(frame) && pick(frame)) { func(frame); }
+            }
+        };
+        sweep([&](const frame_id_t frame) { return pin_count[frame] != 0; });
+        sweep([&](const frame_id_t frame) { return pin_count[frame] == 0 && (state[frame] & REFERENCED) != 0; });
+        sweep([&](const frame_id_t frame) { return pin_count[frame] == 0 && (state[frame] & REFERENCED) == 0; });
+    }
+};
+
+
+
+// 2Q (Johnson & Shasha, full version). New pages enter A1in, a FIFO holding ~25% of the frames. Pages pushed out of A1in
+//  are remembered in the A1out ghost list, and only a page that is re-read while still in A1out is promoted to Am, the
+//  LRU main queue. A one-pass scan therefore only ever cycles A1in and leaves Am (the hot set) alone.
+// Pinned Am frames are unlinked and relinked at the MRU end on unpin. A1in frames keep their FIFO slot while pinned
+//  (relinking would turn it into an LRU and nothing would ever graduate), evict() steps over them instead
+template <typename alloc_t = std::allocator<char>>
+class TwoQReplacer {
+    using Traits = std::allocator_traits<alloc_t>;
+    using U8Allocator  = typename Traits::template rebind_alloc<uint8_t>;
+    using U32Allocator = typename Traits::template rebind_alloc<uint32_t>;
+    using PIDAllocator = typename Traits::template rebind_alloc<page_id_t>;
+
+    enum Queue : uint8_t { NONE, A1IN, AM };
+
+    const size_t kin;
+    std::vector<uint8_t, U8Allocator> queue;    // Frame -> which queue it belongs to, even while pinned
+    std::vector<uint32_t, U32Allocator> pin_count;
+    std::vector<page_id_t, PIDAllocator> frame_pid;
+    FrameList<alloc_t> a1in;
+    FrameList<alloc_t> am;
+    GhostList<alloc_t> a1out;
+    size_t a1in_resident = 0; // Including pinned
+    size_t a1in_pinned = 0;
+
+    // Oldest unpinned A1in frame, -1 if there is none
+    [[nodiscard]] frame_id_t a1in_victim() const noexcept {
+        if (a1in_pinned == a1in.size()) { return -1; }
+        frame_id_t frame = a1in.back();
+        while (frame != -1 && pin_count[frame] != 0) { frame = a1in.prev_of(frame); }
+        return frame;
+    }
+
+    public:
+    explicit TwoQReplacer(const size_t frame_count, const alloc_t& alloc = alloc_t{})
+        : kin(std::max<size_t>(frame_count / 4, 1)), queue(frame_count, NONE, U8Allocator(alloc)), pin_count(frame_count, 0, U32Allocator(alloc)), frame_pid(frame_count, 0, PIDAllocator(alloc)),
+          a1in(frame_count, alloc), am(frame_count, alloc), a1out(std::max<size_t>(frame_count / 2, 1), alloc) {}
+
+    TwoQReplacer(const TwoQReplacer&) = delete;
+    TwoQReplacer& operator=(const TwoQReplacer&) = delete;
+
+    void record_access(const frame_id_t frame, const page_id_t pid) {
+        switch (queue[frame]) {
+            case A1IN: return; // Correlated re-reference, stays where it is
+            case AM: // LRU
+                if (am.contains(frame)) { am.erase(frame); am.push_front(frame); }
+                return;
+            case NONE: break;
+        }
+
+        frame_pid[frame] = pid;
+        if (a1out.contains(pid)) { // Second time around, it's hot
+            a1out.erase(pid);
+            queue[frame] = AM;
+        } else {
+            queue[frame] = A1IN;
+            a1in_resident++;
+            a1in.push_front(frame);
+            if (pin_count[frame] != 0) { a1in_pinned++; }
+            return;
+        }
+        if (pin_count[frame] == 0) { am.push_front(frame); }
+    }
+
+    void pin(const frame_id_t frame) noexcept {
+        if (pin_count[frame]++ != 0) { return; }
+        if (queue[frame] == A1IN) { a1in_pinned++; }
+        if (queue[frame] == AM) { am.erase(frame); }
+    }
+
+    void unpin(const frame_id_t frame) noexcept {
+        STACK_TRACE_ASSERT(pin_count[frame] > 0);
+        if (--pin_count[frame] != 0) { return; }
+        if (queue[frame] == A1IN) { a1in_pinned--; }
+        if (queue[frame] == AM) { am.push_front(frame); }
+    }
+
+    void remove(const frame_id_t frame) {
+        STACK_TRACE_ASSERT(pin_count[frame] == 0);
+        switch (queue[frame]) {
+            case NONE: return;
+            case A1IN: a1in.erase(frame); a1in_resident--; break;
+            case AM:   am.erase(frame); break;
+        }
+        queue[frame] = NONE;
+    }
+
+    [[nodiscard]] auto evict() -> std::optional<frame_id_t> {
+        return evict([](frame_id_t) { return true; });
+    }
+
+    template <typename claim_t>
+    [[nodiscard]] auto evict(claim_t&& try_claim) -> std::optional<frame_id_t> {
+        while (true) {
+            // Reclaim from A1in while it is over its share, or when Am has nothing unpinned
+            const frame_id_t a1in_frame = a1in_victim();
+            const bool from_a1in = a1in_frame != -1 && (a1in_resident > kin || am.empty());
+            if (!from_a1in && am.empty()) { return std::nullopt; }
+
+            const frame_id_t victim = from_a1in ? a1in_frame : am.back();
+            if (!try_claim(victim)) {
+                pin(victim);
+                continue;
+            }
+            if (from_a1in) { a1out.push_front(frame_pid[victim]); }
+            remove(victim);
+            return victim;
+        }
+    }
+
+    [[nodiscard]] size_t size() const noexcept { return (a1in.size() - a1in_pinned) + am.size(); }
+
+    // Pinned Am frames, Am MRU first, then A1in newest first
+    template <typename Func>
+    void for_each_hottest_first(Func&& func) const {
+        for (size_t frame = 0; frame < queue.size(); frame++) {
+            if (queue[frame] == AM && pin_count[frame] != 0) { func(static_cast<frame_id_t>(frame)); }
+        }
+        am.for_each_mru_first(func);
+        a1in.for_each_mru_first(func);
+    }
+};
+
+
+
+// ARC (Megiddo & Modha). T1 holds pages seen once recently, T2 pages seen at least twice, B1/B2 remember what was evicted
+//  from each. A miss that hits a ghost list shifts the target size p of T1 towards the list that would have kept the page,
+//  so the split between recency and frequency tunes itself. Scans only ever flow through T1.
+// Pinned frames are unlinked from T1/T2 (but still count towards their size) and relinked at the MRU end on unpin
+template <typename alloc_t = std::allocator<char>>
+class ARCReplacer {
+    using Traits = std::allocator_traits<alloc_t>;
+    using U8Allocator  = typename Traits::template rebind_alloc<uint8_t>;
+    using U32Allocator = typename Traits::template rebind_alloc<uint32_t>;
+    using PIDAllocator = typename Traits::template rebind_alloc<page_id_t>;
+
+    enum List : uint8_t { NONE, T1, T2 };
+
+    const size_t c;
+    size_t p = 0; // Target size of T1
+    std::vector<uint8_t, U8Allocator> list;
+    std::vector<uint32_t, U32Allocator> pin_count;
+    std::vector<page_id_t, PIDAllocator> frame_pid;
+    FrameList<alloc_t> t1;
+    FrameList<alloc_t> t2;
+    GhostList<alloc_t> b1;
+    GhostList<alloc_t> b2;
+    size_t t1_resident = 0; // Including pinned
+    size_t t2_resident = 0;
+
+    void link(const frame_id_t frame) noexcept {
+        (list[frame] == T1 ? t1 : t2).push_front(frame);
+    }
+
+    void unlink(const frame_id_t frame) noexcept {
+        FrameList<alloc_t>& l = list[frame] == T1 ? t1 : t2;
+        if (l.contains(frame)) { l.erase(frame); }
+    }
+
+    public:
+    explicit ARCReplacer(const size_t frame_count, const alloc_t& alloc = alloc_t{})
+        : c(frame_count), list(frame_count, NONE, U8Allocator(alloc)), pin_count(frame_count, 0, U32Allocator(alloc)), frame_pid(frame_count, 0, PIDAllocator(alloc)),
+          t1(frame_count, alloc), t2(frame_count, alloc), b1(frame_count, alloc), b2(frame_count, alloc) {}
+
+    ARCReplacer(const ARCReplacer&) = delete;
+    ARCReplacer& operator=(const ARCReplacer&) = delete;
+
+    void record_access(const frame_id_t frame, const page_id_t pid) {
+        if (list[frame] != NONE) { // Hit in T1 or T2, becomes frequent
+            if (list[frame] == T1) { t1_resident--; t2_resident++; }
+            unlink(frame);
+            list[frame] = T2;
+            if (pin_count[frame] == 0) { link(frame); }
+            return;
+        }
+
+        frame_pid[frame] = pid;
+        if (b1.contains(pid)) { // Should have kept more recency
+            p = std::min(c, p + std::max<size_t>(b2.size() / std::max<size_t>(b1.size(), 1), 1));
+            b1.erase(pid);
+            list[frame] = T2;
+            t2_resident++;
+        } else if (b2.contains(pid)) { // Should have kept more frequency
+            const size_t delta = std::max<size_t>(b1.size() / std::max<size_t>(b2.size(), 1), 1);
+            p = p > delta ? p - delta : 0;
+            b2.erase(pid);
+            list[frame] = T2;
+            t2_resident++;
+        } else { // Brand new, keep the directory at 2c pages
+            if (t1_resident + b1.size() >= c) {
+                b1.pop_back();
+            } else if (t1_resident + t2_resident + b1.size() + b2.size() >= 2 * c) {
+                b2.pop_back();
+            }
+            list[frame] = T1;
+            t1_resident++;
+        }
+        if (pin_count[frame] == 0) { link(frame); }
+    }
+
+    void pin(const frame_id_t frame) noexcept {
+        if (pin_count[frame]++ == 0 && list[frame] != NONE) { unlink(frame); }
+    }
+
+    void unpin(const frame_id_t frame) noexcept {
+        STACK_TRACE_ASSERT(pin_count[frame] > 0);
+        if (--pin_count[frame] == 0 && list[frame] != NONE) { link(frame); }
+    }
+
+    void remove(const frame_id_t frame) {
+        STACK_TRACE_ASSERT(pin_count[frame] == 0);
+        if (list[frame] == NONE) { return; }
+        unlink(frame);
+        (list[frame] == T1 ? t1_resident : t2_resident)--;
+        list[frame] = NONE;
+    }
+
+    // REPLACE(): T1 while it is over target, T2 otherwise. Falls back to the other list if every frame in one is pinned
+    [[nodiscard]] auto evict() -> std::optional<frame_id_t> {
+        return evict([](frame_id_t) { return true; });
+    }
+
+    template <typename claim_t>
+    [[nodiscard]] auto evict(claim_t&& try_claim) -> std::optional<frame_id_t> {
+        while (true) {
+            const bool prefer_t1 = t1_resident > p || t2.empty();
+            const bool from_t1 = prefer_t1 ? !t1.empty() : t2.empty();
+            if (from_t1 ? t1.empty() : t2.empty()) { return std::nullopt; }
+
+            const frame_id_t victim = from_t1 ? t1.back() : t2.back();
+            if (!try_claim(victim)) {
+                pin(victim);
+                continue;
+            }
+            (from_t1 ? b1 : b2).push_front(frame_pid[victim]);
+            remove(victim);
+            return victim;
+        }
+    }
+
+    [[nodiscard]] size_t size() const noexcept { return t1.size() + t2.size(); }
+
+    // Pinned frames, T2 MRU first, then T1 MRU first
+    template <typename Func>
+    void for_each_hottest_first(Func&& func) const {
+        for (size_t frame = 0; frame < list.size(); frame++) {
+            if (list[frame] != NONE && pin_count[frame] != 0) { func(static_cast<frame_id_t>(frame)); }
+        }
+        t2.for_each_mru_first(func);
+        t1.for_each_mru_first(func);
+    }
+};
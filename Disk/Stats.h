@@ -0,0 +1,78 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Counter written by one thread only, read by any. The add is a plain load and store, no locked instruction, so counting
+//  on a hot path costs about as much as a non atomic increment. Readers may miss the latest adds, never see a torn value
+class SingleWriterCounter {
+    std::atomic<uint64_t> value{0};
+
+    public:
+    void add(const uint64_t n = 1) noexcept { value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+    [[nodiscard]] auto load() const noexcept -> uint64_t { return value.load(std::memory_order_relaxed); }
+};
+
+// Log2 latency histogram. Bucket 0 counts 0ns, bucket i [2^(i-1), 2^i) ns, the last one everything from ~4.6 minutes up.
+//  Percentiles are bucket upper bounds, i.e. within 2x
+struct LatencyHistogram {
+    static constexpr size_t BUCKETS = 40;
+    std::array<uint64_t, BUCKETS> buckets{};
+    uint64_t total_ns = 0;
+
+    [[nodiscard]] static auto bucket_of(const uint64_t ns) noexcept -> size_t { return std::min<size_t>(std::bit_width(ns), BUCKETS - 1); }
+    [[nodiscard]] static auto bucket_upper_ns(const size_t bucket) noexcept -> uint64_t { return bucket == 0 ? 0 : uint64_t{1} << bucket; }
+
+    [[nodiscard]] auto count() const noexcept -> uint64_t {
+        uint64_t n = 0;
+        for (const uint64_t b : buckets) { n += b; }
+        return n;
+    }
+
+    [[nodiscard]] auto mean_ns() const noexcept -> double {
+        const uint64_t n = count();
+        return n == 0 ? 0.0 : static_cast<double>(total_ns) / static_cast<double>(n);
+    }
+
+    // p in [0, 1], 0 if empty
+    [[nodiscard]] auto percentile_ns(const double p) const noexcept -> uint64_t {
+        const uint64_t n = count();
+        if (n == 0) { return 0; }
+        const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(p * static_cast<double>(n) + 0.5));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; i++) {
+            seen += buckets[i];
+            if (seen >= rank) { return bucket_upper_ns(i); }
+        }
+        return bucket_upper_ns(BUCKETS - 1);
+    }
+
+    auto operator+=(const LatencyHistogram& other) noexcept -> LatencyHistogram& {
+        for (size_t i = 0; i < BUCKETS; i++) { buckets[i] += other.buckets[i]; }
+        total_ns += other.total_ns;
+        return *this;
+    }
+};
+
+// Where one thread records into a LatencyHistogram, see SingleWriterCounter
+class LatencyRecorder {
+    std::array<SingleWriterCounter, LatencyHistogram::BUCKETS> buckets;
+    SingleWriterCounter total_ns;
+
+    public:
+    void record(const std::chrono::nanoseconds elapsed) noexcept {
+        const auto ns = static_cast<uint64_t>(std::max<int64_t>(elapsed.count(), 0));
+        buckets[LatencyHistogram::bucket_of(ns)].add();
+        total_ns.add(ns);
+    }
+
+    void add_to(LatencyHistogram& histogram) const noexcept {
+        for (size_t i = 0; i < LatencyHistogram::BUCKETS; i++) { histogram.buckets[i] += buckets[i].load(); }
+        histogram.total_ns += total_ns.load();
+    }
+};
@@ -1,9 +1,14 @@
 
 #include "BufferPool.h"
 #include "PageGuard.h"
+#include "Replacer.h"
+#include "PageTable.h"
 #include "ThreadPool.h"
 
+#include <algorithm>
 #include <cassert>
+#include <filesystem>
+#include <latch>
 #include <memory_resource>
 #include <ostream>
 #include <iostream>
@@ -227,42 +232,1140 @@ void thread_test() {
 
 
     constexpr int num_workers = 2;
-    std::byte pool_buffer[1024 * 64];
-    std::pmr::monotonic_buffer_resource pool_resource(pool_buffer, sizeof(pool_buffer));
-    PmrThreadPool pool(num_workers, &pool_resource);
     static std::atomic<int> reader_count = 0;
     static std::atomic<int> writer_count = 0;
-    constexpr int num_ops = 600000;
+    {
+        std::byte pool_buffer[1024 * 64];
+        std::pmr::monotonic_buffer_resource pool_resource(pool_buffer, sizeof(pool_buffer));
+        PmrThreadPool pool(num_workers, &pool_resource);
+        constexpr int num_ops = 600000;
+        for (int i = 0; i < num_ops; i++) {
+            const int op = op_gen.next() % MAX_OP;
+            switch (op) {
+                case 0: { // Write
+                    const unsigned int wait = timer_gen.next() % MAX_TIMER;
+                    const unsigned int num_loops = (loop_gen.next() % MAX_LOOP) + MIN_LOOP;
+
+                    writer_count.fetch_add(1);
+                    pool.give_work(write_func<decltype(bp)>, std::ref(bp),  std::ref(writer_count), wait, num_loops);
+                } break; 
+                case 1: { // Read
+                    const unsigned int wait = timer_gen.next() % MAX_TIMER;
+                    const unsigned int num_loops = (loop_gen.next() % MAX_LOOP) + MIN_LOOP;
+
+                    reader_count.fetch_add(1);
+                    pool.give_work(read_func<decltype(bp)>, std::ref(bp), std::ref(reader_count), wait, num_loops);
+                } break;
+                default:
+                    FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("Shouldn't be here");
+            }
+        }
+
+        // std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+        // bp.mu.lock();
+        THREAD_PRINT("Joining (" + std::to_string(num_workers) + ") threads. Writers (" + std::to_string(writer_count) + "), Readers (" + std::to_string(reader_count) + ")");
+        // bp.mu.unlock();
+        // pool.wait_until_idle();
+    } // Join workers before reading the pool's counters
+
+    const IOStats io = bp.io_stats();
+    std::cout << "Disk reads (" << io.read_ops << "), syscalls per read (" << io.syscalls_per_read()
+              << "). Disk writes (" << io.write_ops << "), syscalls per write (" << io.syscalls_per_write() << ")\n";
+}
+
+// Many threads miss on the same cold page at once. Only the first should hit the disk, the rest sleep on its load
+void hot_page_load_test() {
+    constexpr int page_size  = 1024 * 4;
+    constexpr int page_count = 4;
+    constexpr int num_threads = 16;
+    const auto* const fp = "./Test/hot_page.test";
+    BufferPool bp(fp, page_size, page_count);
+
+    std::latch start{num_threads};
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads);
+    for (int i = 0; i < num_threads; i++) {
+        threads.emplace_back([&]() {
+            start.arrive_and_wait();
+            auto [rpg, rc] = bp.get_read_page_guard(0);
+            STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+        });
+    }
+    for (auto& t : threads) { t.join(); }
+
+    STACK_TRACE_EXPECT(uint64_t{1}, bp.io_stats().read_ops);
+    std::cout << "Hot page load: (" << num_threads << ") requesters, (" << bp.io_stats().read_ops << ") disk read\n";
+}
+// Pages are only written when evicted dirty or flushed, never per guard release, and nothing is lost on the way
+void write_back_test() {
+    constexpr int page_size  = 64;
+    constexpr int page_count = 4;
+    constexpr int num_pages  = 16;
+    const auto* const fp = "./Test/write_back.test";
+    std::filesystem::remove(fp);
+
+    {
+        BufferPool bp(fp, page_size, page_count);
+        for (int i = 0; i < 100; i++) { // Hot page, many small updates
+            auto [wpg, rc] = bp.get_write_page_guard(0);
+            STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+            wpg.write("a", 0);
+        }
+        STACK_TRACE_EXPECT(uint64_t{0}, bp.io_stats().write_ops);
+        STACK_TRACE_ASSERT(bp.flush_page(0));
+        STACK_TRACE_ASSERT(bp.flush_page(0)); // Clean now, no second write
+        STACK_TRACE_EXPECT(uint64_t{1}, bp.io_stats().write_ops);
+
+        { auto [wpg, rc] = bp.get_write_page_guard(0); } // Write guard that never writes leaves the page clean
+        for (page_id_t pid = 1; pid < num_pages; pid++) { // 4 frames, every load after the 4th evicts a dirty page
+            auto [wpg, rc] = bp.get_write_page_guard(pid);
+            STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+            const char msg = static_cast<char>('a' + pid);
+            wpg.write({&msg, 1}, 0);
+        }
+        for (page_id_t pid = 0; pid < num_pages; pid++) {
+            auto [rpg, rc] = bp.get_read_page_guard(pid);
+            STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+            STACK_TRACE_EXPECT(static_cast<char>('a' + pid), rpg.read()[0]);
+        }
+        STACK_TRACE_EXPECT(uint64_t{num_pages}, bp.io_stats().write_ops); // Page 0 once, every other page once on its way out
+        std::cout << "Write back: (" << bp.io_stats().write_ops << ") disk writes for (" << 100 + num_pages - 1 << ") modifying guards\n";
+    } // Dtor flushes what's still dirty
+
+    BufferPool bp(fp, page_size, page_count);
+    for (page_id_t pid = 0; pid < num_pages; pid++) {
+        auto [rpg, rc] = bp.get_read_page_guard(pid);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+        STACK_TRACE_EXPECT(static_cast<char>('a' + pid), rpg.read()[0]);
+    }
+}
+// Update some pages, go quiet for a moment, then scan enough new pages to push them all out. Without the background flusher
+// every dirty page is written by the miss that evicts it, with it they should already be clean by then
+auto flusher_workload(const bool background) -> IOStats {
+    constexpr int page_size  = 512;
+    constexpr int page_count = 64;
+    constexpr int rounds     = 20;
+    constexpr int updates    = page_count / 4;
+    const auto* const fp = "./Test/flusher.test";
+    BufferPoolOptions options;
+    options.background_flusher = background;
+    options.flusher_dirty_high = 0.0;
+    options.flusher_dirty_low  = 0.0;
+    options.flusher_interval   = std::chrono::milliseconds(1);
+    BufferPool bp(fp, page_size, page_count, std::allocator<char>{}, options);
+
+    page_id_t next_pid = 0;
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < updates; i++) {
+            auto [wpg, rc] = bp.get_write_page_guard(next_pid++);
+            STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+            wpg.write("x", 0);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        for (int i = 0; i < page_count; i++) {
+            auto [rpg, rc] = bp.get_read_page_guard(next_pid++);
+            STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+        }
+    }
+    return bp.io_stats();
+}
+
+void flusher_test() {
+    const IOStats without = flusher_workload(false);
+    const IOStats with    = flusher_workload(true);
+    STACK_TRACE_EXPECT(uint64_t{20 * 16}, without.foreground_writes);
+    STACK_TRACE_ASSERT(with.foreground_writes < without.foreground_writes);
+    std::cout << "Background flusher: foreground writes (" << without.foreground_writes << ") without, (" << with.foreground_writes
+              << ") with, (" << with.background_writes << ") written in the background\n";
+}
+
+// Rate limited flusher under steady write pressure. Every miss that writes back its victim kicks the flusher, the limit has
+// to hold anyway
+void flusher_rate_limit_test() {
+    constexpr int page_size  = 512;
+    constexpr int page_count = 32;
+    constexpr size_t per_sec = 50;
+    const auto* const fp = "./Test/flusher_rate.test";
+    std::filesystem::remove(fp);
+    BufferPoolOptions options;
+    options.background_flusher = true;
+    options.flusher_dirty_high = 0.0;
+    options.flusher_dirty_low  = 0.0;
+    options.flusher_max_writes_per_sec = per_sec;
+    BufferPool bp(fp, page_size, page_count, std::allocator<char>{}, options);
+
+    const auto start = std::chrono::steady_clock::now();
+    for (page_id_t pid = 0; std::chrono::steady_clock::now() - start < std::chrono::milliseconds(200); pid++) {
+        auto [wpg, rc] = bp.get_write_page_guard(pid % (4 * page_count));
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+        wpg.write("x", 0);
+    }
+    const uint64_t background = bp.io_stats().background_writes;
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    STACK_TRACE_ASSERT(background > 0);
+    STACK_TRACE_ASSERT(static_cast<double>(background) <= 1.0 + static_cast<double>(per_sec) * elapsed);
+    std::cout << "Background flusher: (" << background << ") writes in (" << elapsed << ") s at (" << per_sec << ") a second\n";
+}
+
+// Dirty pages written in random order go out sorted, one pwritev per run of adjacent pids, from two regions at once
+void checkpoint_test() {
+    constexpr int page_size  = 512;
+    constexpr int page_count = 256; // Big enough that a batch never has to cut a run
+    constexpr int num_pages  = 48;
+    const auto* const fp = "./Test/checkpoint.test";
+    std::filesystem::remove(fp);
+    BufferPoolOptions options;
+    options.checkpoint_threads = 2;
+
+    std::vector<page_id_t> pids;
+    for (page_id_t pid = 0; pid < num_pages; pid++) {
+        if (pid % 8 != 0) { pids.push_back(pid); } // 6 runs of 7
+    }
+    std::shuffle(pids.begin(), pids.end(), std::mt19937{42});
+    {
+        BufferPool bp(fp, page_size, page_count, std::allocator<char>{}, options);
+        for (const page_id_t pid : pids) {
+            auto [wpg, rc] = bp.get_write_page_guard(pid);
+            STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+            const char msg = static_cast<char>('a' + pid % 26);
+            wpg.write({&msg, 1}, 0);
+        }
+        STACK_TRACE_ASSERT(bp.checkpoint());
+        const IOStats stats = bp.io_stats();
+        STACK_TRACE_EXPECT(static_cast<uint64_t>(pids.size()), stats.write_ops);
+        STACK_TRACE_ASSERT(stats.write_syscalls <= 7); // 6 runs, one of them might be cut in two by the regions
+        STACK_TRACE_ASSERT(bp.checkpoint());
+        STACK_TRACE_EXPECT(stats.write_ops, bp.io_stats().write_ops); // Nothing dirty left
+        std::cout << "Checkpoint: (" << stats.write_ops << ") dirty pages in (" << stats.write_syscalls << ") writes\n";
+    }
+
+    BufferPool bp(fp, page_size, page_count);
+    for (const page_id_t pid : pids) {
+        auto [rpg, rc] = bp.get_read_page_guard(pid);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+        STACK_TRACE_EXPECT(static_cast<char>('a' + pid % 26), rpg.read()[0]);
+    }
+}
+
+// A few hot pages among a scan, the next pool on the file starts with them resident. Then again into a smaller pool, which
+// only has room for the hottest
+void warm_restart_test() {
+    constexpr int page_size  = 512;
+    constexpr int page_count = 32;
+    constexpr int num_pages  = 128;
+    constexpr int num_hot    = 4;
+    const auto* const fp = "./Test/warm_restart.test";
+    std::filesystem::remove(fp);
+    std::filesystem::remove(std::string(fp) + ".warm");
+    BufferPoolOptions options;
+    options.warm_restart = true;
+    options.warm_restart_wait = true;
+
+    const auto touch_hot = [](auto& bp) {
+        for (int round = 0; round < 4; round++) {
+            for (page_id_t pid = 0; pid < num_hot; pid++) {
+                auto [rpg, rc] = bp.get_read_page_guard(pid);
+                STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+                STACK_TRACE_EXPECT(static_cast<char>('a' + pid % 26), rpg.read()[0]);
+            }
+        }
+    };
+
+    {
+        BufferPool bp(fp, page_size, page_count, std::allocator<char>{}, options);
+        STACK_TRACE_EXPECT(uint64_t{0}, bp.io_stats().read_ops); // Nothing saved yet
+        for (page_id_t pid = 0; pid < num_pages; pid++) {
+            auto [wpg, rc] = bp.get_write_page_guard(pid);
+            STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+            const char msg = static_cast<char>('a' + pid % 26);
+            wpg.write({&msg, 1}, 0);
+        }
+        touch_hot(bp);
+    }
+    STACK_TRACE_ASSERT(std::filesystem::exists(std::string(fp) + ".warm"));
+
+    {
+        BufferPool bp(fp, page_size, page_count, std::allocator<char>{}, options);
+        const IOStats warm = bp.io_stats();
+        STACK_TRACE_EXPECT(uint64_t{page_count}, warm.read_ops);
+        touch_hot(bp);
+        STACK_TRACE_EXPECT(warm.read_ops, bp.io_stats().read_ops);
+        std::cout << "Warm restart: (" << warm.read_ops << ") pages prewarmed in (" << warm.read_syscalls << ") reads\n";
+    }
+
+    {
+        constexpr int small_page_count = 8;
+        BufferPool bp(fp, page_size, small_page_count, std::allocator<char>{}, options);
+        const IOStats warm = bp.io_stats();
+        STACK_TRACE_EXPECT(uint64_t{small_page_count}, warm.read_ops);
+        touch_hot(bp);
+        STACK_TRACE_EXPECT(warm.read_ops, bp.io_stats().read_ops);
+    }
+
+    // A count the file can't hold is a corrupt set, the pool opens cold instead of sizing anything by it
+    {
+        const RAII_FD warm_fd(open((std::string(fp) + ".warm").c_str(), O_WRONLY | O_CLOEXEC));
+        STACK_TRACE_ASSERT(warm_fd.valid());
+        const uint64_t huge = uint64_t{1} << 60;
+        STACK_TRACE_EXPECT(static_cast<ssize_t>(sizeof(huge)), pwrite(warm_fd.get(), &huge, sizeof(huge), 2 * sizeof(uint64_t)));
+    }
+    BufferPool bp(fp, page_size, page_count, std::allocator<char>{}, options);
+    STACK_TRACE_EXPECT(uint64_t{0}, bp.io_stats().read_ops);
+}
+
+// Same pages through every backend, then one batch of reads straight through the async backend. io_uring submits the whole
+// batch in one syscall
+void io_backend_test() {
+    constexpr int page_size  = 512;
+    constexpr int page_count = 32;
+    constexpr int num_pages  = 128;
+    const auto* const fp = "./Test/io_backend.test";
+
+    for (const IOBackendKind kind : {IOBackendKind::SYNC, IOBackendKind::THREAD_POOL, IOBackendKind::IO_URING}) {
+        std::filesystem::remove(fp);
+        BufferPoolOptions options;
+        options.io_backend = kind;
+        options.io_queue_depth = 16;
+        std::string name;
+        {
+            BufferPool bp(fp, page_size, page_count, std::allocator<char>{}, options);
+            name = bp.io_backend_name();
+            for (page_id_t pid = 0; pid < num_pages; pid++) {
+                auto [wpg, rc] = bp.get_write_page_guard(pid);
+                STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+                const char msg = static_cast<char>('0' + pid % 64);
+                wpg.write({&msg, 1}, page_size - 1);
+            }
+            STACK_TRACE_ASSERT(bp.flush_all());
+        }
+        BufferPool bp(fp, page_size, page_count, std::allocator<char>{}, options);
+        for (page_id_t pid = 0; pid < num_pages; pid++) {
+            auto [rpg, rc] = bp.get_read_page_guard(pid);
+            STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+            STACK_TRACE_EXPECT(static_cast<char>('0' + pid % 64), rpg.read()[page_size - 1]);
+        }
+        std::cout << "IO backend (" << name << "): ok\n";
+    }
+
+    constexpr int batch = 32;
+    const std::unique_ptr<IOBackend> backend = make_io_backend(IOBackendKind::IO_URING, batch);
+    const int fd = open(fp, O_RDONLY | O_CLOEXEC);
+    STACK_TRACE_ASSERT(fd >= 0);
+    std::vector<char> buffer(static_cast<size_t>(page_size) * batch);
+    std::vector<iovec> iovs(batch);
+    std::vector<IORequest> requests;
+    for (int i = 0; i < batch; i++) {
+        iovs[i] = iovec{buffer.data() + i * page_size, page_size};
+        requests.push_back(IORequest{IORequest::READ, fd, static_cast<off_t>(i) * page_size, &iovs[i], 1});
+    }
+    const uint64_t syscalls = backend->submit_and_wait(requests);
+    close(fd);
+    for (int i = 0; i < batch; i++) {
+        STACK_TRACE_EXPECT(static_cast<ssize_t>(page_size), requests[i].result);
+        STACK_TRACE_EXPECT(static_cast<char>('0' + i % 64), buffer[i * page_size + page_size - 1]);
+    }
+    std::cout << "IO backend (" << backend->name() << "): (" << batch << ") page reads in flight, (" << syscalls << ") syscalls to submit\n";
+}
+
+// Round trip with the page cache out of the way (the kernel rejects misaligned O_DIRECT I/O, so this checks the arena too). Whether the filesystem under ./Test can do direct I/O is up to the machine,
+// a page size that can't be aligned never can
+void direct_io_test() {
+    constexpr int page_size  = 1024 * 4;
+    constexpr int page_count = 8;
+    constexpr int num_pages  = 32;
+    const auto* const fp = "./Test/direct_io.test";
+    std::filesystem::remove(fp);
+    BufferPoolOptions options;
+    options.direct_io = true;
+
+    bool direct = false;
+    {
+        BufferPool bp(fp, page_size, page_count, std::allocator<char>{}, options);
+        direct = bp.direct_io();
+        for (page_id_t pid = 0; pid < num_pages; pid++) {
+            auto [wpg, rc] = bp.get_write_page_guard(pid);
+            STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+            const char msg = static_cast<char>('a' + pid % 26);
+            wpg.write({&msg, 1}, page_size - 1);
+        }
+    }
+    BufferPool bp(fp, page_size, page_count, std::allocator<char>{}, options);
+    for (page_id_t pid = 0; pid < num_pages; pid++) {
+        auto [rpg, rc] = bp.get_read_page_guard(pid);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+        STACK_TRACE_EXPECT(static_cast<char>('a' + pid % 26), rpg.read()[page_size - 1]);
+    }
+
+    BufferPool unaligned("./Test/direct_io_unaligned.test", 100, page_count, std::allocator<char>{}, options);
+    STACK_TRACE_ASSERT(!unaligned.direct_io());
+    { auto [wpg, rc] = unaligned.get_write_page_guard(3); STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc); wpg.write("x", 0); }
+    STACK_TRACE_ASSERT(unaligned.flush_all());
+    std::cout << "Direct I/O: " << (direct ? "on" : "not supported here, fell back to the page cache") << "\n";
+}
+
+// Prefetched pages are read in batches without being pinned, then hit. Prefetching resident pages reads nothing
+void prefetch_test() {
+    constexpr int page_size  = 512;
+    constexpr int page_count = 64;
+    constexpr int num_pages  = 48;
+    const auto* const fp = "./Test/prefetch.test";
+    std::filesystem::remove(fp);
+    BufferPoolOptions options;
+    options.io_backend = IOBackendKind::IO_URING;
+    options.io_queue_depth = 16;
+    {
+        BufferPool bp(fp, page_size, page_count, std::allocator<char>{}, options);
+        for (page_id_t pid = 0; pid < num_pages; pid++) {
+            auto [wpg, rc] = bp.get_write_page_guard(pid);
+            STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+            const char msg = static_cast<char>('a' + pid % 26);
+            wpg.write({&msg, 1}, 0);
+        }
+    }
+
+    BufferPool bp(fp, page_size, page_count, std::allocator<char>{}, options);
+    std::vector<page_id_t> pids(num_pages);
+    for (page_id_t pid = 0; pid < num_pages; pid++) { pids[pid] = pid; }
+    bp.prefetch(pids);
+    bp.wait_for_prefetches();
+    const IOStats prefetched = bp.io_stats();
+    STACK_TRACE_EXPECT(uint64_t{num_pages}, prefetched.read_ops);
+    STACK_TRACE_EXPECT(uint64_t{num_pages}, prefetched.prefetch_reads);
+
+    bp.prefetch(pids);
+    bp.wait_for_prefetches();
+    for (page_id_t pid = 0; pid < num_pages; pid++) {
+        auto [rpg, rc] = bp.get_read_page_guard(pid);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+        STACK_TRACE_EXPECT(static_cast<char>('a' + pid % 26), rpg.read()[0]);
+    }
+    STACK_TRACE_EXPECT(uint64_t{num_pages}, bp.io_stats().read_ops);
+    std::cout << "Prefetch (" << bp.io_backend_name() << "): (" << num_pages << ") pages in (" << prefetched.read_syscalls
+              << ") syscalls, every guard after it hit\n";
+}
+
+// Cold scans with read-ahead off and on, then a strided one. With it on the scanning thread should rarely block on a read,
+// and runs of pages come off disk in single reads
+auto read_ahead_scan(const size_t read_ahead_max, const page_id_t stride) -> IOStats {
+    constexpr int page_size  = 1024 * 4;
+    constexpr int page_count = 128;
+    constexpr int num_pages  = 1024;
+    const auto* const fp = "./Test/read_ahead.test";
+    if (!std::filesystem::exists(fp) || std::filesystem::file_size(fp) < static_cast<size_t>(page_size) * num_pages) {
+        BufferPool bp(fp, page_size, page_count);
+        for (page_id_t pid = 0; pid < num_pages; pid++) {
+            auto [wpg, rc] = bp.get_write_page_guard(pid);
+            STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+            const char msg = static_cast<char>('a' + pid % 26);
+            wpg.write({&msg, 1}, 0);
+        }
+    }
+
+    BufferPoolOptions options;
+    options.read_ahead_max = read_ahead_max;
+    BufferPool bp(fp, page_size, page_count, std::allocator<char>{}, options);
+    const auto start = std::chrono::high_resolution_clock::now();
+    for (page_id_t pid = 0; pid < num_pages; pid += stride) {
+        auto [rpg, rc] = bp.get_read_page_guard(pid);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+        STACK_TRACE_EXPECT(static_cast<char>('a' + pid % 26), rpg.read()[0]);
+    }
+    const double elapsed_s = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    bp.wait_for_prefetches();
+    const IOStats stats = bp.io_stats();
+    std::cout << "Read-ahead (" << read_ahead_max << "), stride (" << stride << "): " << (num_pages / stride / elapsed_s / 1e6)
+              << " M pages/s, (" << stats.read_ops << ") page reads in (" << stats.read_syscalls << ") syscalls, ("
+              << stats.prefetch_reads << ") read ahead\n";
+    return stats;
+}
+
+void read_ahead_test() {
+    const IOStats off = read_ahead_scan(0, 1);
+    STACK_TRACE_EXPECT(uint64_t{0}, off.prefetch_reads);
+    STACK_TRACE_EXPECT(off.read_ops, off.read_syscalls);
+
+    const IOStats on = read_ahead_scan(32, 1);
+    STACK_TRACE_ASSERT(on.prefetch_reads > on.read_ops / 2);
+    STACK_TRACE_ASSERT(on.read_syscalls < on.read_ops / 2); // Coalesced
+    STACK_TRACE_ASSERT(on.read_ops <= off.read_ops + 32);   // Nothing read twice, at most one window past the end
+
+    const IOStats strided = read_ahead_scan(32, 3);
+    STACK_TRACE_ASSERT(strided.prefetch_reads > strided.read_ops / 2);
+}
+
+void lru_k_replacer_test() {
+    LRUKReplacer<> replacer(4); // k = 2
+    // Frame 0 and 1 get two accesses, 2 and 3 only one (infinite backward 2-distance)
+    for (const frame_id_t frame : {0, 1, 2, 0, 1, 3}) {
+        replacer.pin(frame);
+        replacer.record_access(frame, frame);
+        replacer.unpin(frame);
+    }
+    std::vector<frame_id_t> hottest;
+    replacer.for_each_hottest_first([&](const frame_id_t frame) { hottest.push_back(frame); });
+    STACK_TRACE_ASSERT((hottest == std::vector<frame_id_t>{1, 0, 3, 2})); // Eviction order reversed
+    replacer.pin(2); // Pinned frames are skipped
+    STACK_TRACE_EXPECT(3, replacer.evict().value()); // Only frame with < k accesses left
+    STACK_TRACE_EXPECT(0, replacer.evict().value()); // Oldest 2nd most recent access
+    replacer.unpin(2);
+    STACK_TRACE_EXPECT(2, replacer.evict().value());
+    STACK_TRACE_EXPECT(1, replacer.evict().value());
+    STACK_TRACE_ASSERT(!replacer.evict().has_value());
+    std::cout << "LRU-K replacer: ok\n";
+}
+
+void page_table_test() {
+    constexpr int entries = 1000;
+    ConcurrentPageTable<> table(entries);
+    for (page_id_t pid = 0; pid < entries; pid++) { table.insert(pid * 7, pid); }
+    // Erase every third entry, backward shift has to keep every other cluster member reachable
+    for (page_id_t pid = 0; pid < entries; pid += 3) { table.erase(pid * 7); }
+    for (page_id_t pid = 0; pid < entries; pid++) {
+        STACK_TRACE_EXPECT(pid % 3 == 0 ? -1 : pid, table.find(pid * 7));
+    }
+    STACK_TRACE_EXPECT(entries - (entries + 2) / 3, static_cast<int>(table.size()));
+    std::cout << "Page table: ok\n";
+}
+
+// Point lookups, mostly over a hot set that fits in the pool with the rest spread over a large cold range, interleaved with
+// one pass scans over pages never seen before. Prints how often a hot lookup had to go to disk, scan resistant policies
+// should keep the hot set resident
+template <template <typename> typename replacer_t>
+void replacement_policy_workload(const char* const name) {
+    constexpr int page_size   = 512;
+    constexpr int page_count  = 64;
+    constexpr int hot_pages   = 40;
+    constexpr int cold_pages  = 1000;
+    constexpr int hot_percent = 80;
+    constexpr int num_ops     = 20000;
+    constexpr int scan_every  = 1000;
+    constexpr int scan_length = 200;
+    const auto* const fp = "./Test/replacement_policy.test";
+    BufferPool<std::allocator<char>, replacer_t> bp(fp, page_size, page_count);
+
+    FastRandom_XORShift gen;
+    page_id_t next_scan_pid = hot_pages + cold_pages;
+    uint64_t hot_lookups = 0;
+    uint64_t hot_misses = 0;
     for (int i = 0; i < num_ops; i++) {
-        const int op = op_gen.next() % MAX_OP;
-        switch (op) {
-            case 0: { // Write
-                const unsigned int wait = timer_gen.next() % MAX_TIMER;
-                const unsigned int num_loops = (loop_gen.next() % MAX_LOOP) + MIN_LOOP;
-
-                writer_count.fetch_add(1);
-                pool.give_work(write_func<decltype(bp)>, std::ref(bp),  std::ref(writer_count), wait, num_loops);
-            } break; 
-            case 1: { // Read
-                const unsigned int wait = timer_gen.next() % MAX_TIMER;
-                const unsigned int num_loops = (loop_gen.next() % MAX_LOOP) + MIN_LOOP;
-
-                reader_count.fetch_add(1);
-                pool.give_work(read_func<decltype(bp)>, std::ref(bp), std::ref(reader_count), wait, num_loops);
-            } break;
-            default:
-                FATAL_ERROR_STACK_TRACE_THROW_CUR_LOC("Shouldn't be here");
+        if (i % scan_every == scan_every - 1) {
+            for (int j = 0; j < scan_length; j++) {
+                auto [rpg, rc] = bp.get_read_page_guard(next_scan_pid++);
+                STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+            }
+        }
+        const bool hot = static_cast<int>(gen.next() % 100) < hot_percent;
+        const page_id_t pid = hot ? static_cast<page_id_t>(gen.next() % hot_pages) : static_cast<page_id_t>(hot_pages + (gen.next() % cold_pages));
+        const uint64_t reads_before = bp.io_stats().read_ops;
+        auto [rpg, rc] = bp.get_read_page_guard(pid);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+        if (hot) {
+            hot_lookups++;
+            hot_misses += bp.io_stats().read_ops - reads_before;
+        }
+    }
+    std::cout << name << ": hot set miss rate (" << (100.0 * hot_misses / hot_lookups) << "%), total disk reads (" << bp.io_stats().read_ops << ")\n";
+}
+
+void replacement_policy_test() {
+    replacement_policy_workload<LRUKReplacer>("LRU-2");
+    replacement_policy_workload<ClockReplacer>("CLOCK");
+    replacement_policy_workload<TwoQReplacer>("2Q");
+    replacement_policy_workload<ARCReplacer>("ARC");
+}
+// A hot set that fits the pool, then one long scan. As a normal read the scan pushes most of the hot set out under CLOCK, as
+// a BULK_READ it stays in its ring and the hot set never misses
+template <template <typename> typename replacer_t>
+auto bulk_read_workload(const AccessHint scan_hint) -> uint64_t {
+    constexpr int page_size  = 512;
+    constexpr int page_count = 64;
+    constexpr int hot_pages  = 48;
+    constexpr int scan_pages = 1000;
+    const auto* const fp = "./Test/bulk_read.test";
+    BufferPool<std::allocator<char>, replacer_t> bp(fp, page_size, page_count);
+
+    for (int round = 0; round < 2; round++) {
+        for (page_id_t pid = 0; pid < hot_pages; pid++) {
+            auto [rpg, rc] = bp.get_read_page_guard(pid);
+            STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+        }
+    }
+    for (page_id_t pid = hot_pages; pid < hot_pages + scan_pages; pid++) {
+        auto [rpg, rc] = bp.get_read_page_guard(pid, scan_hint);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+    }
+    const uint64_t reads_before = bp.io_stats().read_ops;
+    for (page_id_t pid = 0; pid < hot_pages; pid++) {
+        auto [rpg, rc] = bp.get_read_page_guard(pid);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+    }
+    return bp.io_stats().read_ops - reads_before;
+}
+
+void bulk_read_test() {
+    const uint64_t normal = bulk_read_workload<ClockReplacer>(AccessHint::NORMAL);
+    const uint64_t bulk   = bulk_read_workload<ClockReplacer>(AccessHint::BULK_READ);
+    STACK_TRACE_EXPECT(uint64_t{0}, bulk);
+    STACK_TRACE_ASSERT(normal > 0);
+    STACK_TRACE_EXPECT(uint64_t{0}, bulk_read_workload<LRUKReplacer>(AccessHint::BULK_READ));
+    STACK_TRACE_EXPECT(uint64_t{0}, bulk_read_workload<TwoQReplacer>(AccessHint::BULK_READ));
+    STACK_TRACE_EXPECT(uint64_t{0}, bulk_read_workload<ARCReplacer>(AccessHint::BULK_READ));
+    std::cout << "Bulk read (CLOCK): hot set misses after a scan, (" << normal << ") as normal reads, (" << bulk << ") as bulk reads\n";
+}
+
+// Grow a pool, fill the new frames, then shrink it back while a guard is out on one of the frames that stays. A guard on
+// the chunk being taken back blocks the shrink until it's released
+void resize_test() {
+    constexpr int page_size  = 512;
+    constexpr int page_count = 32;
+    constexpr int max_pages  = 128;
+    const auto* const fp = "./Test/resize.test";
+    std::filesystem::remove(fp);
+    BufferPoolOptions options;
+    options.shard_count = 2;
+    options.max_page_count = max_pages;
+    BufferPool bp(fp, page_size, page_count, std::allocator<char>{}, options);
+
+    const auto write_page = [&](const page_id_t pid) {
+        auto [wpg, rc] = bp.get_write_page_guard(pid);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+        const char msg = static_cast<char>('a' + pid % 26);
+        wpg.write({&msg, 1}, 0);
+    };
+    for (page_id_t pid = 0; pid < page_count; pid++) { write_page(pid); }
+    auto [survivor, survivor_rc] = bp.get_read_page_guard(0);
+    STACK_TRACE_EXPECT(PageGuardFailRC::ok, survivor_rc);
+
+    STACK_TRACE_EXPECT(size_t{max_pages}, bp.resize(max_pages * 2)); // Capped
+    STACK_TRACE_EXPECT(size_t{max_pages}, bp.capacity());
+    for (page_id_t pid = page_count; pid < max_pages; pid++) { write_page(pid); }
+    const uint64_t writes_before = bp.io_stats().write_ops; // Pids don't split evenly over the shards, a few might have been evicted
+
+    {
+        auto [rpg, rc] = bp.get_read_page_guard(max_pages - 1); // In the new chunk
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+        STACK_TRACE_EXPECT(size_t{max_pages}, bp.resize(page_count));
+    }
+    STACK_TRACE_EXPECT(size_t{page_count}, bp.resize(page_count));
+    STACK_TRACE_ASSERT(bp.io_stats().write_ops >= writes_before + (max_pages - 2 * page_count)); // Written back on the way out
+    STACK_TRACE_EXPECT('a', survivor.read()[0]);
+    survivor.release();
+
+    for (page_id_t pid = 0; pid < max_pages; pid++) {
+        auto [rpg, rc] = bp.get_read_page_guard(pid);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+        STACK_TRACE_EXPECT(static_cast<char>('a' + pid % 26), rpg.read()[0]);
+    }
+
+    // Readers keep going while the pool grows and shrinks under them
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 3; t++) {
+        readers.emplace_back([&, t]() {
+            std::mt19937 rng(t);
+            while (!stop.load()) {
+                const auto pid = static_cast<page_id_t>(rng() % max_pages);
+                auto [rpg, rc] = bp.get_read_page_guard(pid);
+                if (rc != PageGuardFailRC::ok) { continue; } // bp_full while a shard is at its smallest
+                STACK_TRACE_EXPECT(static_cast<char>('a' + pid % 26), rpg.read()[0]);
+            }
+        });
+    }
+    int shrinks = 0;
+    for (int i = 0; i < 50; i++) {
+        STACK_TRACE_EXPECT(size_t{max_pages}, bp.resize(max_pages));
+        if (bp.resize(page_count) == page_count) { shrinks++; }
+    }
+    stop.store(true);
+    for (auto& reader : readers) { reader.join(); }
+    std::cout << "Resize: (" << page_count << ") -> (" << max_pages << ") -> (" << page_count << ") frames, (" << shrinks << "/50) shrinks under readers\n";
+}
+
+// A pinned page stays resident through a scan that turns the rest of the pool over, without holding off guards on it.
+// Pinning every frame leaves nothing to evict
+void pinned_page_test() {
+    constexpr int page_size  = 512;
+    constexpr int page_count = 8;
+    const auto* const fp = "./Test/pinned_page.test";
+    std::filesystem::remove(fp);
+    BufferPool bp(fp, page_size, page_count);
+
+    auto [pinned, rc] = bp.get_pinned_page(0);
+    STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+    {
+        auto [wpg, wrc] = bp.get_write_page_guard(0); // Not latched by the pin, so no deadlock
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, wrc);
+        wpg.write("p", 0);
+    }
+    for (page_id_t pid = 1; pid < 4 * page_count; pid++) {
+        auto [wpg, wrc] = bp.get_write_page_guard(pid);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, wrc);
+    }
+    const uint64_t reads = bp.io_stats().read_ops;
+    {
+        ReadPageGuard rpg = pinned.read_guard();
+        STACK_TRACE_EXPECT('p', rpg.read()[0]);
+        pinned.release(); // The guard has its own pin
+        STACK_TRACE_EXPECT('p', rpg.read()[0]);
+    }
+    STACK_TRACE_EXPECT(reads, bp.io_stats().read_ops); // Never left
+
+    std::vector<PinnedPage> all;
+    for (page_id_t pid = 0; pid < page_count; pid++) {
+        auto [page, prc] = bp.get_pinned_page(100 + pid);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, prc);
+        all.push_back(std::move(page));
+    }
+    STACK_TRACE_EXPECT(PageGuardFailRC::bp_full, bp.get_read_page_guard(0).second);
+    {
+        WritePageGuard wpg = all[0].write_guard();
+        wpg.write("q", 0);
+    }
+    all.clear();
+    auto [rpg, rrc] = bp.get_read_page_guard(0);
+    STACK_TRACE_EXPECT(PageGuardFailRC::ok, rrc);
+    STACK_TRACE_EXPECT('p', rpg.read()[0]); // Written back when pinning the others evicted it
+    std::cout << "Pinned page: ok\n";
+}
+
+// Optimistic reads see a write in the middle of them, and never validate a torn page: a writer keeps the first and last
+// 8 bytes of the page equal, readers that validated must have seen them equal
+void optimistic_read_test() {
+    constexpr int page_size  = 512;
+    constexpr int page_count = 8;
+    constexpr int num_readers = 3;
+    constexpr int num_writes = 20000;
+    const auto* const fp = "./Test/optimistic_read.test";
+    std::filesystem::remove(fp);
+    BufferPool bp(fp, page_size, page_count);
+    auto [pinned, rc] = bp.get_pinned_page(0);
+    STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+
+    OptimisticReadGuard org = pinned.optimistic_read_guard();
+    std::array<char, 1> byte{};
+    STACK_TRACE_ASSERT(org.copy_out(byte, 0));
+    pinned.write_guard().write("x", 0);
+    STACK_TRACE_ASSERT(!org.validate()); // Written since
+    org.restart();
+    STACK_TRACE_ASSERT(org.copy_out(byte, 0));
+    STACK_TRACE_EXPECT('x', byte[0]);
+    {
+        WritePageGuard wpg = pinned.write_guard();
+        STACK_TRACE_ASSERT(!pinned.optimistic_read_guard().validate()); // Writer in
+        wpg.write(std::string(sizeof(uint64_t), '\0'), 0); // First and last 8 bytes equal before the readers start
+    }
+
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> validated{0};
+    std::atomic<uint64_t> failed{0};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < num_readers; t++) {
+        readers.emplace_back([&]() {
+            std::array<char, page_size> copy{};
+            while (!stop.load(std::memory_order_relaxed)) {
+                std::this_thread::yield(); // Interleave with the writer even on one core
+                const OptimisticReadGuard guard = pinned.optimistic_read_guard();
+                if (!guard.copy_out(copy, 0)) {
+                    failed.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                uint64_t first = 0;
+                uint64_t last = 0;
+                std::memcpy(&first, copy.data(), sizeof(first));
+                std::memcpy(&last, copy.data() + page_size - sizeof(last), sizeof(last));
+                STACK_TRACE_EXPECT(first, last);
+                validated.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+    uint64_t writes = 0;
+    while (writes < num_writes) {
+        writes++;
+        {
+            WritePageGuard wpg = pinned.write_guard();
+            wpg.write({reinterpret_cast<const char*>(&writes), sizeof(writes)}, 0);
+            if (writes % 16 == 0) { std::this_thread::yield(); } // Mid write, so readers run into half written pages too
+            wpg.write({reinterpret_cast<const char*>(&writes), sizeof(writes)}, page_size - sizeof(writes));
+        }
+        if (writes % 16 == 8) { std::this_thread::yield(); }
+    }
+    stop.store(true);
+    for (auto& reader : readers) { reader.join(); }
+    std::cout << "Optimistic reads: (" << validated.load() << ") validated, (" << failed.load() << ") retried, under (" << writes << ") writes\n";
+}
+
+// A lone reader upgrades, a second reader makes the upgrade fail instead of deadlocking, and a downgrade keeps the write.
+// Then threads increment a counter read-then-upgrade, falling back to a write guard on conflict, and lose no increment
+void upgrade_downgrade_test() {
+    constexpr int page_size  = 512;
+    constexpr int page_count = 8;
+    constexpr int num_threads = 4;
+    constexpr int num_increments = 2000;
+    const auto* const fp = "./Test/upgrade_downgrade.test";
+    std::filesystem::remove(fp);
+    BufferPool bp(fp, page_size, page_count);
+
+    {
+        auto [rpg, rc] = bp.get_read_page_guard(0);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+        std::optional<WritePageGuard> wpg = rpg.try_upgrade();
+        STACK_TRACE_ASSERT(wpg.has_value());
+        wpg->write("u", 0);
+        ReadPageGuard again = wpg->downgrade();
+        STACK_TRACE_EXPECT('u', again.read()[0]);
+        auto [other, orc] = bp.get_read_page_guard(0); // Readers get in after the downgrade
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, orc);
+        STACK_TRACE_ASSERT(!again.try_upgrade().has_value());
+        STACK_TRACE_EXPECT('u', again.read()[0]); // Still held
+        other.release();
+        STACK_TRACE_ASSERT(again.try_upgrade().has_value());
+    }
+    STACK_TRACE_ASSERT(bp.flush_page(0));
+    STACK_TRACE_EXPECT(uint64_t{1}, bp.io_stats().write_ops); // Dirty through the downgrade
+
+    std::atomic<uint64_t> upgraded{0};
+    std::atomic<uint64_t> fell_back{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++) {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < num_increments; i++) {
+                auto [rpg, rc] = bp.get_read_page_guard(1);
+                STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+                if ((i & 7) == 0) { std::this_thread::yield(); } // Overlap readers on one core too
+                std::optional<WritePageGuard> wpg = rpg.try_upgrade();
+                if (wpg.has_value()) {
+                    upgraded.fetch_add(1, std::memory_order_relaxed);
+                } else {
+                    rpg.release();
+                    wpg.emplace(bp.get_write_page_guard(1).first);
+                    fell_back.fetch_add(1, std::memory_order_relaxed);
+                }
+                uint64_t count = 0;
+                std::memcpy(&count, wpg->read().data(), sizeof(count)); // Read again under the write latch
+                count++;
+                wpg->write({reinterpret_cast<const char*>(&count), sizeof(count)}, 0);
+            }
+        });
+    }
+    for (auto& thread : threads) { thread.join(); }
+    auto [rpg, rc] = bp.get_read_page_guard(1);
+    STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+    uint64_t count = 0;
+    std::memcpy(&count, rpg.read().data(), sizeof(count));
+    STACK_TRACE_EXPECT(uint64_t{num_threads * num_increments}, count);
+    std::cout << "Upgrade / downgrade: (" << upgraded.load() << ") upgraded, (" << fell_back.load() << ") fell back to a write guard\n";
+}
+
+// try_ guards give up at once on a conflicting latch, timed ones at the deadline or as soon as it's free. A failed try
+// leaves nothing pinned behind: afterwards every frame can still be taken
+void try_guard_test() {
+    constexpr int page_size  = 512;
+    constexpr int page_count = 8;
+    const auto* const fp = "./Test/try_guard.test";
+    std::filesystem::remove(fp);
+    BufferPool bp(fp, page_size, page_count);
+
+    {
+        auto [wpg, rc] = bp.get_write_page_guard(0);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+        for (int i = 0; i < 1000; i++) {
+            STACK_TRACE_EXPECT(PageGuardFailRC::page_in_use, bp.try_get_read_page_guard(0).second);
+            STACK_TRACE_EXPECT(PageGuardFailRC::page_in_use, bp.try_get_write_page_guard(0).second);
         }
+        const auto start = std::chrono::steady_clock::now();
+        STACK_TRACE_EXPECT(PageGuardFailRC::page_in_use, bp.try_get_read_page_guard_for(0, std::chrono::milliseconds(20)).second);
+        STACK_TRACE_ASSERT(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20));
     }
+    {
+        auto [rpg, rc] = bp.try_get_read_page_guard(0);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, bp.try_get_read_page_guard(0).second); // Readers share
+        STACK_TRACE_EXPECT(PageGuardFailRC::page_in_use, bp.try_get_write_page_guard(0).second);
 
-    // std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        std::thread releaser([&]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            rpg.release();
+        });
+        const auto start = std::chrono::steady_clock::now();
+        auto [wpg, wrc] = bp.try_get_write_page_guard_for(0, std::chrono::seconds(10));
+        const auto waited = std::chrono::steady_clock::now() - start;
+        releaser.join();
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, wrc);
+        STACK_TRACE_ASSERT(waited < std::chrono::seconds(10));
+    }
 
-    // bp.mu.lock();
-    THREAD_PRINT("Joining (" + std::to_string(num_workers) + ") threads. Writers (" + std::to_string(writer_count) + "), Readers (" + std::to_string(reader_count) + ")");
-    // bp.mu.unlock();
-    // pool.wait_until_idle();
+    std::vector<PinnedPage> all; // Page 0 evicted to make room, so its failed tries unpinned it
+    for (page_id_t pid = 1; pid <= page_count; pid++) {
+        auto [page, rc] = bp.get_pinned_page(pid);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+        all.push_back(std::move(page));
+    }
+    std::cout << "Try guards: ok\n";
 }
 
+// Several pages latched at once load in one read and come back in the order asked for. Threads then take overlapping
+// page sets in random order, next to a thread holding one write guard while taking another in descending order, which
+// deadlocks with plain guards taken in ascending order. Every increment must land
+void multi_page_guard_test() {
+    constexpr int page_size  = 512;
+    constexpr int page_count = 16;
+    constexpr int num_pages = 6;
+    constexpr int num_threads = 3;
+    constexpr int num_rounds = 1000;
+    const auto* const fp = "./Test/multi_page_guard.test";
+    std::filesystem::remove(fp);
+    BufferPool bp(fp, page_size, page_count);
+
+    {
+        const std::array<page_id_t, 3> write_pids{12, 10, 11};
+        const std::array<page_id_t, 1> read_pids{13};
+        auto [set, rc] = bp.get_page_guards(write_pids, read_pids);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+        STACK_TRACE_EXPECT(size_t{3}, set.write.size());
+        for (size_t i = 0; i < write_pids.size(); i++) { STACK_TRACE_EXPECT(write_pids[i], set.write[i].pid()); }
+        STACK_TRACE_EXPECT(page_id_t{13}, set.read[0].pid());
+        STACK_TRACE_EXPECT(uint64_t{4}, bp.io_stats().read_ops);
+        STACK_TRACE_EXPECT(uint64_t{1}, bp.io_stats().read_syscalls); // 10..13 in one read
+        STACK_TRACE_EXPECT(uint64_t{0}, bp.io_stats().prefetch_reads);
+    }
+
+    // Holding a latch on one of the pages, only the try / timed versions are safe. They fail without leaving anything latched
+    {
+        auto [held, hrc] = bp.get_write_page_guard(12);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, hrc);
+        const std::array<page_id_t, 2> write_pids{11, 12};
+        auto [tset, trc] = bp.try_get_page_guards(write_pids, {});
+        STACK_TRACE_EXPECT(PageGuardFailRC::page_in_use, trc);
+        STACK_TRACE_EXPECT(size_t{0}, tset.write.size());
+        auto [fset, frc] = bp.try_get_page_guards_for(write_pids, {}, std::chrono::milliseconds(1));
+        STACK_TRACE_EXPECT(PageGuardFailRC::page_in_use, frc);
+        auto [free, rc] = bp.try_get_write_page_guard(11);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+    }
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++) {
+        threads.emplace_back([&bp, t]() {
+            FastRandom_XORShift gen(t + 1);
+            for (int round = 0; round < num_rounds; round++) {
+                std::array<page_id_t, 3> pids{};
+                for (size_t i = 0; i < pids.size(); i++) {
+                    do { pids[i] = static_cast<page_id_t>(gen.next() % num_pages); } while (std::find(pids.begin(), pids.begin() + i, pids[i]) != pids.begin() + i);
+                }
+                auto [guards, rc] = bp.get_write_page_guards(pids);
+                STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+                for (WritePageGuard& guard : guards) {
+                    uint64_t count = 0;
+                    std::memcpy(&count, guard.read().data(), sizeof(count));
+                    count++;
+                    guard.write({reinterpret_cast<const char*>(&count), sizeof(count)}, 0);
+                }
+                if (round % 64 == 0) { std::this_thread::yield(); } // Overlap with the others on one core too
+            }
+        });
+    }
+    threads.emplace_back([&bp]() {
+        for (int round = 0; round < num_rounds; round++) {
+            auto [high, hrc] = bp.get_write_page_guard(num_pages - 1);
+            STACK_TRACE_EXPECT(PageGuardFailRC::ok, hrc);
+            if (round % 64 == 0) { std::this_thread::yield(); }
+            auto [low, lrc] = bp.get_write_page_guard(0);
+            STACK_TRACE_EXPECT(PageGuardFailRC::ok, lrc);
+        }
+    });
+    for (auto& thread : threads) { thread.join(); }
+
+    uint64_t total = 0;
+    for (page_id_t pid = 0; pid < num_pages; pid++) {
+        auto [rpg, rc] = bp.get_read_page_guard(pid);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+        uint64_t count = 0;
+        std::memcpy(&count, rpg.read().data(), sizeof(count));
+        total += count;
+    }
+    STACK_TRACE_EXPECT(uint64_t{num_threads * num_rounds * 3}, total);
+    std::cout << "Multi page guards: (" << total << ") increments over (" << num_threads * num_rounds << ") page sets\n";
+}
+
+// Invariant checks run as often as the mode says, each scanning one shard's frames. Hits on resident pages never check
+void invariant_check_test() {
+    constexpr int page_size  = 512;
+    constexpr int page_count = 16;
+    constexpr int num_misses = 64;
+    const auto* const fp = "./Test/invariant_check.test";
+    const auto run = [&](const InvariantCheckMode mode) {
+        std::filesystem::remove(fp);
+        BufferPoolOptions options;
+        options.invariant_checks = mode;
+        options.invariant_check_interval = 4;
+        BufferPool bp(fp, page_size, page_count, std::allocator<char>{}, options);
+        for (page_id_t pid = 0; pid < num_misses; pid++) {
+            auto [rpg, rc] = bp.get_read_page_guard(pid);
+            STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+        }
+        const InvariantCheckStats misses = bp.invariant_check_stats();
+        for (int i = 0; i < 1000; i++) {
+            auto [rpg, rc] = bp.get_read_page_guard(num_misses - 1);
+            STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+        }
+        STACK_TRACE_EXPECT(misses.checks, bp.invariant_check_stats().checks);
+        return misses;
+    };
+    const InvariantCheckStats off = run(InvariantCheckMode::OFF);
+    const InvariantCheckStats sampled = run(InvariantCheckMode::SAMPLED);
+    const InvariantCheckStats always = run(InvariantCheckMode::ALWAYS);
+    STACK_TRACE_EXPECT(uint64_t{0}, off.checks);
+    STACK_TRACE_EXPECT(uint64_t{num_misses}, always.checks);
+    STACK_TRACE_EXPECT(uint64_t{num_misses / 4}, sampled.checks);
+    STACK_TRACE_EXPECT(uint64_t{num_misses * page_count}, always.frames_scanned); // One shard
+    std::cout << "Invariant checks: (" << off.checks << ") off, (" << sampled.checks << ") sampled, (" << always.checks << ") always, ("
+              << always.frames_scanned / always.checks << ") frames per check\n";
+}
+
+// Counters add up to what was done: a scan over twice the pool misses and evicts, dirty pages come back as write backs,
+// a reader blocked on a write guard shows up as a latch wait, and thread_stats() only has the calling thread's share
+void stats_test() {
+    constexpr int page_size  = 512;
+    constexpr int page_count = 8;
+    const auto* const fp = "./Test/stats.test";
+    std::filesystem::remove(fp);
+    BufferPoolOptions options;
+    options.stats_hit_sample_interval = 1;
+    BufferPool bp(fp, page_size, page_count, std::allocator<char>{}, options);
+
+    for (page_id_t pid = 0; pid < 2 * page_count; pid++) {
+        auto [wpg, rc] = bp.get_write_page_guard(pid);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+        wpg.write("s", 0);
+    }
+    for (int i = 0; i < 100; i++) {
+        auto [rpg, rc] = bp.get_read_page_guard(2 * page_count - 1);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+    }
+    BufferPoolStats stats = bp.stats();
+    STACK_TRACE_EXPECT(uint64_t{2 * page_count}, stats.misses);
+    STACK_TRACE_EXPECT(uint64_t{100}, stats.hits);
+    STACK_TRACE_EXPECT(uint64_t{page_count}, stats.evictions);
+    STACK_TRACE_EXPECT(uint64_t{page_count}, stats.write_backs);
+    STACK_TRACE_EXPECT(uint64_t{page_count * page_size}, stats.bytes_written);
+    STACK_TRACE_EXPECT(uint64_t{2 * page_count * page_size}, stats.bytes_read);
+    STACK_TRACE_EXPECT(uint64_t{page_count}, stats.dirty_frames);
+    STACK_TRACE_EXPECT(stats.misses, stats.miss_latency.count());
+    STACK_TRACE_EXPECT(stats.hits, stats.hit_latency.count());
+    STACK_TRACE_EXPECT(stats.page_reads, stats.disk_read_latency.count());
+    STACK_TRACE_ASSERT(stats.miss_latency.percentile_ns(0.5) <= stats.miss_latency.percentile_ns(0.99));
+
+    {
+        auto [wpg, rc] = bp.get_write_page_guard(0);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+        STACK_TRACE_EXPECT(size_t{1}, bp.stats().pinned_frames);
+        BufferPoolStats reader{};
+        std::atomic<bool> started{false};
+        std::thread blocked([&]() {
+            started.store(true);
+            auto [rpg, rrc] = bp.get_read_page_guard(0);
+            STACK_TRACE_EXPECT(PageGuardFailRC::ok, rrc);
+            reader = bp.thread_stats();
+        });
+        // Whether the reader is asleep on the latch by the release can't be seen from here, so at most one wait
+        while (!started.load()) { std::this_thread::yield(); }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        wpg.release();
+        blocked.join();
+        STACK_TRACE_ASSERT(reader.latch_waits <= 1);
+        STACK_TRACE_ASSERT((reader.latch_waits == 0) == (reader.latch_wait_ns == 0));
+        STACK_TRACE_EXPECT(uint64_t{1}, reader.hits + reader.misses);
+    }
+    STACK_TRACE_EXPECT(size_t{0}, bp.stats().pinned_frames);
+    const BufferPoolStats mine = bp.thread_stats();
+    stats = bp.stats();
+    STACK_TRACE_EXPECT(stats.hits + stats.misses, mine.hits + mine.misses + 1); // All but the other thread's one
+    std::cout << "Stats: hit ratio (" << stats.hit_ratio() << "), miss p50 (" << stats.miss_latency.percentile_ns(0.5) << ") ns, hit p50 ("
+              << stats.hit_latency.percentile_ns(0.5) << ") ns, (" << stats.latch_waits << ") latch waits for (" << stats.latch_wait_ns / 1'000'000 << ") ms\n";
+}
+
+// Read hits on a fully resident pool from 1..max threads. With the page table sharded, throughput should grow with threads
+void read_hit_scaling_test() {
+    constexpr int page_size  = 1024 * 4;
+    constexpr int page_count = 1024;
+    constexpr int resident_pages = page_count / 2;
+    constexpr int hits_per_thread = 100000;
+    const auto* const fp = "./Test/read_hit_scaling.test";
+    BufferPool bp(fp, page_size, page_count);
+    for (page_id_t pid = 0; pid < resident_pages; pid++) {
+        auto [rpg, rc] = bp.get_read_page_guard(pid);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+    }
+
+    const unsigned int max_threads = std::max(4U, std::thread::hardware_concurrency());
+    for (unsigned int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+        std::latch start{num_threads + 1};
+        std::vector<std::thread> threads;
+        threads.reserve(num_threads);
+        for (unsigned int t = 0; t < num_threads; t++) {
+            threads.emplace_back([&, t]() {
+                FastRandom_XORShift gen(t + 1, 2 * t + 1);
+                start.arrive_and_wait();
+                for (int i = 0; i < hits_per_thread; i++) {
+                    auto [rpg, rc] = bp.get_read_page_guard(static_cast<page_id_t>(gen.next() % resident_pages));
+                    STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+                }
+            });
+        }
+        const auto begin = std::chrono::steady_clock::now();
+        start.arrive_and_wait();
+        for (auto& t : threads) { t.join(); }
+        const double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        std::cout << "Read hits, (" << num_threads << ") threads: " << (num_threads * hits_per_thread / elapsed_s / 1e6) << " M/s\n";
+    }
+    STACK_TRACE_EXPECT(static_cast<uint64_t>(resident_pages), bp.io_stats().read_ops); // Never missed after the warmup
+}
+
+// Per access cost of the guards themselves, on one resident page: get + release of a read and a write guard, and moving a
+// read guard back and forth
+void guard_overhead_benchmark() {
+    constexpr int page_size  = 512;
+    constexpr int page_count = 16;
+    constexpr int iterations = 1'000'000;
+    const auto* const fp = "./Test/guard_overhead.test";
+    BufferPool bp(fp, page_size, page_count);
+    {
+        auto [rpg, rc] = bp.get_read_page_guard(0);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+    }
+
+    const auto ns_per = [](const auto begin) {
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() / iterations;
+    };
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        auto [rpg, rc] = bp.get_read_page_guard(0);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+    }
+    const double read_ns = ns_per(begin);
+
+    begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        auto [wpg, rc] = bp.get_write_page_guard(0);
+        STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+    }
+    const double write_ns = ns_per(begin);
+
+    std::vector<ReadPageGuard> slots(8); // Hops around a vector so the moves can't be optimized out
+    auto [held, rc] = bp.get_read_page_guard(0);
+    STACK_TRACE_EXPECT(PageGuardFailRC::ok, rc);
+    slots[0] = std::move(held);
+    begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        slots[(i + 1) % slots.size()] = std::move(slots[i % slots.size()]);
+    }
+    const double move_ns = ns_per(begin);
+    STACK_TRACE_EXPECT(page_id_t{0}, slots[iterations % slots.size()].pid());
+
+    std::cout << "Guard overhead: read (" << read_ns << ") ns, write (" << write_ns << ") ns, move (" << move_ns << ") ns, sizeof read ("
+              << sizeof(ReadPageGuard) << ") write (" << sizeof(WritePageGuard) << ")\n";
+}
 
 void disk_test() {
     int loop_count = 0;
@@ -278,6 +1381,31 @@ void disk_test() {
     auto total_end = std::chrono::high_resolution_clock::now();
     auto total_elapsed_ms = std::chrono::duration<double, std::milli>(total_end - total_start).count();
     std::cout << "Total elapsed: " << total_elapsed_ms << " ms\n"; 
+
+    hot_page_load_test();
+    write_back_test();
+    flusher_test();
+    flusher_rate_limit_test();
+    checkpoint_test();
+    warm_restart_test();
+    io_backend_test();
+    direct_io_test();
+    prefetch_test();
+    read_ahead_test();
+    lru_k_replacer_test();
+    page_table_test();
+    replacement_policy_test();
+    bulk_read_test();
+    resize_test();
+    pinned_page_test();
+    optimistic_read_test();
+    upgrade_downgrade_test();
+    try_guard_test();
+    multi_page_guard_test();
+    invariant_check_test();
+    stats_test();
+    read_hit_scaling_test();
+    guard_overhead_benchmark();
 }
 
 void write_correctness_test() { // Should create a file with 10 "hello world"s next to eachother
@@ -10,6 +10,8 @@
 #include <deque>
 #include <condition_variable>
 #include <atomic>
+#include <optional>
+#include <memory_resource>
 
 
 template<typename Func, typename... Args>